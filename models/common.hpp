@@ -2,18 +2,41 @@
 
 #include <fmt/core.h>
 #include <chrono>
+#include <cstdint>
+#include <string>
 
 using TimePoint = std::chrono::system_clock::time_point;
 
 typedef long double Money;
 typedef long double Percent;
 
+// Dense ids of the models::SymbolTable of the context.
+using SymbolId = uint32_t;  // <COIN>_<QUOTE>
+using AssetId = uint32_t;   // coin or quote asset
+
 enum class Exchange {
   kBinance,
   kMexc,
   kGate,
 };
 
+inline constexpr size_t kExchanges = 3;
+// Longest <COIN>_<QUOTE> name, the fixed size of bus and checkpoint records.
+inline constexpr size_t kMaxSymbolSize = 16;
+
+// Lower case name of the exchange in the feed, tick store and their paths.
+inline std::string exchange_dir(Exchange exchange) {
+  switch (exchange) {
+    case Exchange::kBinance:
+      return "binance";
+    case Exchange::kMexc:
+      return "mexc";
+    case Exchange::kGate:
+      return "gate";
+  }
+  return "unknown";
+}
+
 template <>
 struct fmt::formatter<Exchange> : fmt::formatter<std::string_view> {
   template <typename FormatContext>
@@ -1,5 +1,8 @@
 #include "context.hpp"
 
+#include <filesystem>
+#include <map>
+
 #include <fmt/format.h>
 #include <quill/LogLevel.h>
 #include <quill/Logger.h>
@@ -40,30 +43,176 @@ void set_log_level(std::string&& log_level, quill::Logger* logger) {
   }
 }
 
-void fill_binance_context(CoinContext& context, const std::string& coin) {
+// "cpu" of the exchange options: -1, a core, a range "2-5" or a list [2, 3].
+std::vector<int> read_cpus(const pt::ptree& node) {
+  std::vector<int> cpus;
+  const auto cpu = node.get_child_optional("cpu");
+  if (!cpu) {
+    return cpus;
+  }
+  if (!cpu->empty()) {
+    for (const auto& item : *cpu) {
+      cpus.push_back(item.second.get_value<int>());
+      if (cpus.back() < 0) {
+        throw std::invalid_argument("negative cpu in the list");
+      }
+    }
+    return cpus;
+  }
+  const auto value = cpu->get_value<std::string>();
+  const auto dash = value.find('-', 1);  // not the sign of -1
+  if (dash == std::string::npos) {
+    if (const auto core = std::stoi(value); core >= 0) {
+      cpus.push_back(core);
+    }
+    return cpus;
+  }
+  const auto first = std::stoi(value.substr(0, dash));
+  const auto last = std::stoi(value.substr(dash + 1));
+  if (first < 0 || last < first) {
+    throw std::invalid_argument("bad cpu range: " + value);
+  }
+  for (auto core = first; core <= last; ++core) {
+    cpus.push_back(core);
+  }
+  return cpus;
+}
+
+ExchangeOptions read_exchange_options(const pt::ptree& config,
+                                      const std::string& exchange) {
+  ExchangeOptions options;
+  const auto node = config.get_child_optional(
+      pt::ptree::path_type("exchange_options/" + exchange, '/'));
+  if (!node) {
+    return options;
+  }
+  options.busy_poll = node->get<bool>("busy_poll", options.busy_poll);
+  options.busy_poll_us = node->get<int>("busy_poll_us", options.busy_poll_us);
+  options.cpus = read_cpus(*node);
+  auto depth = node->get<std::string>("depth", "snapshot");
+  boost::algorithm::to_lower(depth);
+  options.diff_depth = depth == "diff";
+  // a dropped diff breaks the book, only snapshots can be conflated
+  options.conflate =
+      node->get<bool>("conflate", options.conflate) && !options.diff_depth;
+  return options;
+}
+
+Mode read_mode(const pt::ptree& config) {
+  auto mode = config.get<std::string>("mode", "standalone");
+  boost::algorithm::to_lower(mode);
+  if (mode == "ingest") {
+    return Mode::kIngest;
+  } else if (mode == "scanner") {
+    return Mode::kScanner;
+  } else if (mode != "standalone") {
+    throw std::invalid_argument("unknown mode: " + mode);
+  }
+  return Mode::kStandalone;
+}
+
+BusOptions read_bus_options(const pt::ptree& config) {
+  BusOptions options;
+  const auto node = config.get_child_optional("bus");
+  if (!node) {
+    return options;
+  }
+  auto transport = node->get<std::string>("transport", "multicast");
+  boost::algorithm::to_lower(transport);
+  options.tcp = transport == "tcp";
+  options.address = node->get<std::string>("address", options.address);
+  options.interface = node->get<std::string>("interface", options.interface);
+  options.port = node->get<unsigned short>("port", options.port);
+  options.node_id = node->get<uint16_t>("node_id", options.node_id);
+  return options;
+}
+
+TriangularOptions read_triangular_options(const pt::ptree& config) {
+  TriangularOptions options;
+  const auto node = config.get_child_optional("triangular");
+  if (!node) {
+    return options;
+  }
+  options.enabled = node->get<bool>("enabled", options.enabled);
+  options.cross_venue = node->get<bool>("cross_venue", options.cross_venue);
+  options.max_length = node->get<size_t>("max_length", options.max_length);
+  options.min_profit = node->get<Percent>("min_profit", options.min_profit);
+  return options;
+}
+
+FeedOptions read_feed_options(const pt::ptree& config) {
+  FeedOptions options;
+  const auto node = config.get_child_optional("feed");
+  if (!node) {
+    return options;
+  }
+  options.enabled = node->get<bool>("enabled", options.enabled);
+  options.path = node->get<std::string>("path", options.path);
+  options.flush_interval_ms = std::chrono::milliseconds(node->get<size_t>(
+      "flush_interval_ms", options.flush_interval_ms.count()));
+  options.segment_mb = node->get<size_t>("segment_mb", options.segment_mb);
+  options.segment_minutes = std::chrono::minutes(node->get<size_t>(
+      "segment_minutes", options.segment_minutes.count()));
+  options.retention_segments =
+      node->get<size_t>("retention_segments", options.retention_segments);
+  options.retention_hours = std::chrono::hours(
+      node->get<size_t>("retention_hours", options.retention_hours.count()));
+  options.compression_level =
+      node->get<int>("compression_level", options.compression_level);
+  return options;
+}
+
+// <dir>/<stem>-<node><extension> of a file shared by the nodes of a machine
+std::string node_file(const std::string& filename, const std::string& node) {
+  if (node.empty()) {
+    return filename;
+  }
+  const std::filesystem::path path(filename);
+  return (path.parent_path() /
+          (path.stem().string() + '-' + node + path.extension().string()))
+      .string();
+}
+
+void fill_binance_context(CoinContext& context, const std::string& coin,
+                          const std::string& quote) {
   static const std::string kDomain = "fstream.binance.com";
   static const std::string kPort = "443";
-  static const fmt::format_string<std::string> kTargetTemplate =
-      "/ws/{}usdt@depth20@100ms";
+  static const fmt::format_string<std::string, std::string> kTargetTemplate =
+      "/ws/{}{}@depth20@100ms";
+  static const fmt::format_string<std::string, std::string>
+      kDiffTargetTemplate = "/ws/{}{}@depth@100ms";
+  static const std::string kSnapshotDomain = "fapi.binance.com";
+  static const fmt::format_string<const std::string&, const std::string&>
+      kSnapshotTargetTemplate = "/fapi/v1/depth?symbol={}{}&limit=1000";
   static const Exchange exchange = Exchange::kBinance;
   static const Percent kCommMaker = 0.02;
   static const Percent kCommTaker = 0.04;
 
-  const auto target =
-      fmt::format(kTargetTemplate, boost::algorithm::to_lower_copy(coin));
+  const auto target = fmt::format(
+      context.options.diff_depth ? kDiffTargetTemplate : kTargetTemplate,
+      boost::algorithm::to_lower_copy(coin),
+      boost::algorithm::to_lower_copy(quote));
   context.domain = kDomain;
   context.port = kPort;
   context.target = target;
+  context.snapshot_domain = kSnapshotDomain;
+  context.snapshot_target = fmt::format(kSnapshotTargetTemplate, coin, quote);
   context.coin = coin;
+  context.quote = quote;
+  context.symbol = coin + '_' + quote;
   context.exchange = exchange;
   context.comm_maker = kCommMaker;
   context.comm_taker = kCommTaker;
 }
 
-void fill_mexc_context(CoinContext& context, const std::string& coin) {
+void fill_mexc_context(CoinContext& context, const std::string& coin,
+                       const std::string& quote) {
   static const std::string kDomain = "contract.mexc.com";
   static const std::string kPort = "443";
   static const std::string kTarget = "/ws";
+  static const std::string kSnapshotDomain = "contract.mexc.com";
+  static const fmt::format_string<const std::string&, const std::string&>
+      kSnapshotTargetTemplate = "/api/v1/contract/depth/{}_{}";
   static const Exchange exchange = Exchange::kMexc;
   static const Percent kCommMaker = 0.00;
   static const Percent kCommTaker = 0.01;
@@ -71,24 +220,41 @@ void fill_mexc_context(CoinContext& context, const std::string& coin) {
   context.domain = kDomain;
   context.port = kPort;
   context.target = kTarget;
+  context.snapshot_domain = kSnapshotDomain;
+  context.snapshot_target = fmt::format(kSnapshotTargetTemplate, coin, quote);
   context.coin = coin;
+  context.quote = quote;
+  context.symbol = coin + '_' + quote;
   context.exchange = exchange;
   context.comm_maker = kCommMaker;
   context.comm_taker = kCommTaker;
 }
 
-void fill_gate_context(CoinContext& context, const std::string& coin) {
+void fill_gate_context(CoinContext& context, const std::string& coin,
+                       const std::string& quote) {
   static const std::string kDomain = "fx-ws.gateio.ws";
   static const std::string kPort = "443";
-  static const std::string kTarget = "/v4/ws/usdt";
+  // futures are grouped by the settle currency
+  static const std::string kTargetPrefix = "/v4/ws/";
+  static const std::string kSnapshotDomain = "api.gateio.ws";
+  static const fmt::format_string<std::string, const std::string&,
+                                  const std::string&>
+      kSnapshotTargetTemplate =
+          "/api/v4/futures/{}/order_book?contract={}_{}&limit=100&with_id=true";
   static const Exchange exchange = Exchange::kGate;
   static const Percent kCommMaker = 0.015;
   static const Percent kCommTaker = 0.05;
 
   context.domain = kDomain;
   context.port = kPort;
-  context.target = kTarget;
+  context.target = kTargetPrefix + boost::algorithm::to_lower_copy(quote);
+  context.snapshot_domain = kSnapshotDomain;
+  context.snapshot_target =
+      fmt::format(kSnapshotTargetTemplate,
+                  boost::algorithm::to_lower_copy(quote), coin, quote);
   context.coin = coin;
+  context.quote = quote;
+  context.symbol = coin + '_' + quote;
   context.exchange = exchange;
   context.comm_maker = kCommMaker;
   context.comm_taker = kCommTaker;
@@ -96,62 +262,163 @@ void fill_gate_context(CoinContext& context, const std::string& coin) {
 
 }  // namespace
 
-Context::Context(const std::string& config_filename)
-    : main_logger(logger::init_root_logger()) {
+Context::Context(const std::string& config_filename,
+                 const std::string& log_filename) {
+  pt::ptree config;
+  pt::read_json(config_filename, config);
+  mode = read_mode(config);
+  bus = read_bus_options(config);
+  // the scanner tells the nodes apart by the id, it has no default
+  if (mode == Mode::kIngest && !config.get_optional<uint16_t>("bus.node_id")) {
+    throw std::invalid_argument("bus.node_id is required in the ingest mode");
+  }
+
+  // the nodes of one machine share the working directory
+  main_logger = logger::init_root_logger(node_file(log_filename, node_name()));
   main_logger->set_log_level(quill::LogLevel::Debug);
 
   LOG_INFO(main_logger, "Start create context");
 
-  pt::ptree config;
-  pt::read_json(config_filename, config);
-
   set_log_level(config.get<std::string>("log_level"), main_logger);
 
   scan_frequency_ms =
       std::chrono::milliseconds(config.get<size_t>("scan_frequency_ms"));
 
+  max_quote_age_ms = std::chrono::milliseconds(
+      config.get<size_t>("max_quote_age_ms", max_quote_age_ms.count()));
   min_profit = config.get<Percent>("min_profit");
+  triangular = read_triangular_options(config);
+  tick_store.enabled = config.get<bool>("tick_store.enabled", false);
+  tick_store.path = config.get<std::string>("tick_store.path", tick_store.path);
+  tick_store.flush_interval_ms = std::chrono::milliseconds(config.get<size_t>(
+      "tick_store.flush_interval_ms", tick_store.flush_interval_ms.count()));
+  feed = read_feed_options(config);
+  if (!node_name().empty()) {
+    feed.path = (std::filesystem::path(feed.path) / node_name()).string();
+  }
+  perf.enabled = config.get<bool>("perf.enabled", false);
+  perf.report_interval_ms = std::chrono::milliseconds(config.get<size_t>(
+      "perf.report_interval_ms", perf.report_interval_ms.count()));
+  checkpoint_path = config.get<std::string>("checkpoint.path", "");
+  checkpoint_interval_ms = std::chrono::milliseconds(config.get<size_t>(
+      "checkpoint.interval_ms", checkpoint_interval_ms.count()));
   auto coins = as_vector<std::string>(config, "coins");
   for (auto& coin : coins) {
     boost::algorithm::to_upper(coin);
   }
+  auto quotes = config.get_child_optional("quotes")
+                    ? as_vector<std::string>(config, "quotes")
+                    : std::vector<std::string>{"USDT"};
+  for (auto& quote : quotes) {
+    boost::algorithm::to_upper(quote);
+  }
   const auto& exchanges = as_vector<std::string>(config, "exchanges");
 
+  std::unordered_map<std::string, ExchangeOptions> options;
+  std::unordered_map<std::string, size_t> pinned;  // streams by exchange
+  for (const auto& exchange : exchanges) {
+    options[exchange] = read_exchange_options(config, exchange);
+  }
+
   for (const auto& coin : coins) {
-    auto logger = logger::make_logger("pure/" + coin + ".log");
-    for (const auto& exchange : exchanges) {
-      LOG_DEBUG(main_logger,
-                "Start create coin context. [coin={}; exchange={}]", coin,
-                exchange);
-
-      coin_to_ctx[coin].push_back({});
-      if (exchange == "binance") {
-        fill_binance_context(coin_to_ctx[coin].back(), coin);
-      } else if (exchange == "mexc") {
-        fill_mexc_context(coin_to_ctx[coin].back(), coin);
-      } else if (exchange == "gate" || exchange == "gateio") {
-        fill_gate_context(coin_to_ctx[coin].back(), coin);
+    for (const auto& quote : quotes) {
+      if (coin == quote) {
+        continue;  // e.g. BTC with the BTC quote
+      }
+      const auto symbol = coin + '_' + quote;
+      if (symbol.size() > kMaxSymbolSize) {
+        throw std::invalid_argument(
+            fmt::format("symbol {} is longer than {} characters", symbol,
+                        kMaxSymbolSize));
+      }
+      for (const auto& exchange : exchanges) {
+        LOG_DEBUG(main_logger,
+                  "Start create coin context. [symbol={}; exchange={}]",
+                  symbol, exchange);
+
+        const auto symbol_id = symbols.intern(symbol);
+        if (symbol_id == coin_to_ctx.size()) {
+          coin_to_ctx.emplace_back();
+        }
+        auto& ctx_by_coin = coin_to_ctx[symbol_id];
+        ctx_by_coin.push_back({});
+        auto& coin_options = ctx_by_coin.back().options;
+        coin_options = options.at(exchange);
+        if (!coin_options.cpus.empty()) {
+          coin_options.cpu =
+              coin_options.cpus[pinned[exchange]++ % coin_options.cpus.size()];
+        }
+        ctx_by_coin.back().symbol_id = symbol_id;
+        ctx_by_coin.back().coin_id = assets.intern(coin);
+        ctx_by_coin.back().quote_id = assets.intern(quote);
+        if (exchange == "binance") {
+          fill_binance_context(ctx_by_coin.back(), coin, quote);
+        } else if (exchange == "mexc") {
+          fill_mexc_context(ctx_by_coin.back(), coin, quote);
+        } else if (exchange == "gate" || exchange == "gateio") {
+          fill_gate_context(ctx_by_coin.back(), coin, quote);
+        }
       }
-      coin_to_ctx[coin].back().logger = logger;
     }
   }
 
+  if (mode != Mode::kScanner) {
+    check_pinning();
+  }
   log_ctx_coin();
 }
 
+// A busy_poll thread never sleeps, a stream that shares its core only runs
+// when the scheduler preempts it.
+void Context::check_pinning() const {
+  std::map<int, std::pair<size_t, bool>> streams;  // count, any busy_poll
+  for (const auto& ctx_by_coin : coin_to_ctx) {
+    for (const auto& coin_ctx : ctx_by_coin) {
+      if (coin_ctx.options.cpu >= 0) {
+        auto& [count, busy_poll] = streams[coin_ctx.options.cpu];
+        ++count;
+        busy_poll = busy_poll || coin_ctx.options.busy_poll;
+      }
+    }
+  }
+  for (const auto& [cpu, usage] : streams) {
+    if (usage.first > 1 && usage.second) {
+      throw std::invalid_argument(fmt::format(
+          "{} streams are pinned to cpu {} with busy_poll, give every "
+          "busy_poll stream a cpu of its own",
+          usage.first, cpu));
+    }
+  }
+}
+
+std::string Context::node_name() const {
+  switch (mode) {
+    case Mode::kStandalone:
+      return "";
+    case Mode::kIngest:
+      return fmt::format("ingest-{}", bus.node_id);
+    case Mode::kScanner:
+      return "scanner";
+  }
+  return "";
+}
+
 void Context::log_ctx_coin() {
   using namespace fmt::literals;
-  for (const auto& [_, ctx_by_coin] : coin_to_ctx) {
+  for (const auto& ctx_by_coin : coin_to_ctx) {
     for (const auto& coin : ctx_by_coin) {
       const auto log = fmt::format(("{exchange},{domain},{coin},{target},{comm_"
-                                    "maker:.4f},{comm_taker:.4f},{logger}"),
+                                    "maker:.4f},{comm_taker:.4f},"
+                                    "{busy_poll},{busy_poll_us},{cpu}"),
                                    "exchange"_a = coin.exchange,      //
                                    "domain"_a = coin.domain,          //
-                                   "coin"_a = coin.coin,              //
+                                   "coin"_a = coin.symbol,            //
                                    "target"_a = coin.target,          //
                                    "comm_maker"_a = coin.comm_maker,  //
                                    "comm_taker"_a = coin.comm_taker,  //
-                                   "logger"_a = (uint64_t)coin.logger);
+                                   "busy_poll"_a = coin.options.busy_poll,  //
+                                   "busy_poll_us"_a = coin.options.busy_poll_us,
+                                   "cpu"_a = coin.options.cpu);
       LOG_DEBUG(main_logger, "{}", log);
     }
   }
@@ -1,21 +1,93 @@
 #pragma once
 
 #include <chrono>
+#include <functional>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
 #include <quill/Logger.h>
 #include <boost/noncopyable.hpp>
 
 #include "common.hpp"
+#include "symbol_table.hpp"
+
+namespace feed {
+class FeedWriter;
+}  // namespace feed
 
 namespace models {
 
+// Per-exchange transport settings, see "exchange_options" in config.json.
+struct ExchangeOptions {
+  bool busy_poll = false;  // spin on the io_context instead of blocking read
+  int busy_poll_us = 0;    // SO_BUSY_POLL budget of the socket, 0 - disabled
+  std::vector<int> cpus;  // cores of the streams, taken in turn, empty - any
+  int cpu = -1;            // core of the stream, one of cpus, -1 - no pin
+  bool diff_depth = false;  // incremental book instead of top/snapshots
+  bool conflate = false;  // parse only the newest of the queued snapshots
+};
+
+// Role of the process, see "mode" in config.json.
+enum class Mode {
+  kStandalone,  // streams and scanner in one process
+  kIngest,      // streams only, quotes are published to the bus
+  kScanner,     // scanner only, quotes are received from the bus
+};
+
+// Quote bus settings, see "bus" in config.json.
+struct BusOptions {
+  bool tcp = false;  // tcp fallback instead of udp multicast
+  std::string address = "239.255.0.1";  // multicast group or tcp host
+  std::string interface = "127.0.0.1";  // multicast interface
+  unsigned short port = 30001;
+  uint16_t node_id = 0;
+};
+
+// Cross-currency cycle search, see "triangular" in config.json.
+struct TriangularOptions {
+  bool enabled = false;
+  bool cross_venue = true;  // free transfers of an asset between exchanges
+  size_t max_length = 4;    // max number of trades in a cycle
+  Percent min_profit = 0.1;
+};
+
+// Columnar history of quotes, see "tick_store" in config.json.
+struct TickStoreOptions {
+  bool enabled = false;
+  std::string path = "logs/ticks";
+  std::chrono::milliseconds flush_interval_ms{100};
+};
+
+// Raw feed and spread records, see "feed" in config.json.
+struct FeedOptions {
+  bool enabled = true;
+  std::string path = "logs/feed";
+  std::chrono::milliseconds flush_interval_ms{100};
+  size_t segment_mb = 256;                 // rotate after this much data
+  std::chrono::minutes segment_minutes{60};  // or after this time
+  size_t retention_segments = 48;          // closed segments kept, 0 - all
+  std::chrono::hours retention_hours{0};   // max age of a segment, 0 - any
+  int compression_level = 6;               // gzip level of closed segments
+};
+
+// Hardware counters of the hot sections, see "perf" in config.json.
+struct PerfOptions {
+  bool enabled = false;
+  std::chrono::milliseconds report_interval_ms{10000};
+};
+
 struct CoinContext {
   std::string domain;
   std::string port;
   std::string target;
-  std::string coin;
+  std::string coin;    // base asset
+  std::string quote;   // quote asset
+  std::string symbol;  // <COIN>_<QUOTE>
+  SymbolId symbol_id = 0;  // index of Context::coin_to_ctx
+  AssetId coin_id = 0;
+  AssetId quote_id = 0;
+  std::string snapshot_domain;  // REST snapshots of the book for diff depth
+  std::string snapshot_target;
   Exchange exchange;
   Percent comm_maker;
   Percent comm_taker;
@@ -27,28 +99,90 @@ struct CoinContext {
       std::chrono::system_clock::now();
   std::chrono::system_clock::time_point ask_time =
       std::chrono::system_clock::now();
-  quill::Logger* logger = nullptr;
+  feed::FeedWriter* feed_writer = nullptr;  // raw frames, nullptr - disabled
+  ExchangeOptions options;
+  uint64_t updates = 0;  // number of quote updates, sequence of the stream
+  uint64_t frames = 0;     // frames received by the stream
+  uint64_t conflated = 0;  // frames dropped unparsed for a newer snapshot
+  uint32_t backlog = 0;    // frames queued behind the last one read
+  bool stale = false;    // restored from a checkpoint, not updated yet
+  // called by the stream thread after every quote update
+  std::function<void(const CoinContext&)> on_update;
 
   CoinContext() = default;
   CoinContext(const CoinContext& other) = delete;
   CoinContext(CoinContext&& other) = default;
 
+  // Top of book without commissions, -1 - the side is empty. The prices the
+  // scanner compares include the commissions of the exchange.
+  void set_top(Money pure_bid, Money pure_ask) {
+    bid_pure = pure_bid;
+    ask_pure = pure_ask;
+    bid = bid_pure > 0 ? bid_pure * (1. + comm_taker * 0.01) : -1;
+    ask = ask_pure > 0 ? ask_pure * (1. - comm_maker * 0.01) : -1;
+  }
+
+  void notify() {
+    ++updates;
+    stale = false;
+    if (on_update) {
+      on_update(*this);
+    }
+  }
+
+  // Dense id of the (symbol, exchange) pair, below Context::market_count.
+  size_t market_id() const {
+    return symbol_id * kExchanges + static_cast<size_t>(exchange);
+  }
+
   std::string to_str() const {
-    return fmt::format("[{:^5}: {:^10}]", coin, exchange);
+    return fmt::format("[{:^10}: {:^10}]", symbol, exchange);
   }
 };
 
+// Scanner aggregates of one coin.
+struct ScanStats {
+  uint64_t opportunities = 0;  // number of passes with an opportunity
+  uint64_t episodes = 0;       // number of runs of such passes
+  Percent max_spread = 0;
+  TimePoint last_opportunity;
+  bool in_episode = false;
+};
+
 class Context : private boost::noncopyable {
  public:
-  std::unordered_map<std::string, std::vector<CoinContext>> coin_to_ctx;
+  SymbolTable symbols;  // <COIN>_<QUOTE>
+  SymbolTable assets;   // coins and quotes
+  // contexts of every exchange by SymbolId
+  std::vector<std::vector<CoinContext>> coin_to_ctx;
   Percent min_profit;
   quill::Logger* main_logger = nullptr;
   std::chrono::milliseconds scan_frequency_ms;
+  // quotes older than this are not scanned, 0 - any age
+  std::chrono::milliseconds max_quote_age_ms{0};
+  Mode mode = Mode::kStandalone;
+  BusOptions bus;
+  TriangularOptions triangular;
+  TickStoreOptions tick_store;
+  FeedOptions feed;
+  PerfOptions perf;
+  std::string checkpoint_path;  // empty - checkpoints are disabled
+  std::chrono::milliseconds checkpoint_interval_ms{1000};
 
  public:
-  explicit Context(const std::string& config_filename);
+  explicit Context(const std::string& config_filename,
+                   const std::string& log_filename = "logs/main.log");
+
+  // Size of the flat arrays indexed by CoinContext::market_id.
+  size_t market_count() const { return symbols.size() * kExchanges; }
+  // Name of the node in the distributed mode, empty - standalone. Suffix of
+  // the main log and subdirectory of the feed, so the nodes of one machine
+  // do not share files.
+  std::string node_name() const;
 
  private:
+  // Throws std::invalid_argument if a busy_poll stream shares its cpu.
+  void check_pinning() const;
   void log_ctx_coin();
 };
 
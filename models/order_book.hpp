@@ -0,0 +1,43 @@
+#pragma once
+
+#include <functional>
+#include <map>
+
+#include "common.hpp"
+
+namespace models {
+
+// Full depth of one symbol on one exchange, maintained from diff streams.
+class OrderBook {
+ private:
+  std::map<Money, Money, std::greater<Money>> bids_;
+  std::map<Money, Money> asks_;
+
+ public:
+  void clear() {
+    bids_.clear();
+    asks_.clear();
+  }
+
+  // Zero quantity removes the level.
+  void set_bid(Money price, Money quantity) { set(bids_, price, quantity); }
+  void set_ask(Money price, Money quantity) { set(asks_, price, quantity); }
+
+  // -1 if the side is empty.
+  Money best_bid() const { return bids_.empty() ? -1 : bids_.begin()->first; }
+  Money best_ask() const { return asks_.empty() ? -1 : asks_.begin()->first; }
+
+  size_t depth() const { return bids_.size() + asks_.size(); }
+
+ private:
+  template <typename Levels>
+  static void set(Levels& levels, Money price, Money quantity) {
+    if (quantity > 0) {
+      levels[price] = quantity;
+    } else {
+      levels.erase(price);
+    }
+  }
+};
+
+}  // namespace models
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace models {
+
+// Dense ids of names interned at config load. Hot paths index flat arrays by
+// id, the names are looked up only at the edges: config, logs, files and the
+// quote bus.
+class SymbolTable {
+ private:
+  struct Hash {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const {
+      return std::hash<std::string_view>{}(name);
+    }
+  };
+
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, uint32_t, Hash, std::equal_to<>> ids_;
+
+ public:
+  // Id of `name`, the next free one if it is new.
+  uint32_t intern(const std::string& name) {
+    const auto [it, inserted] = ids_.try_emplace(name, names_.size());
+    if (inserted) {
+      names_.push_back(name);
+    }
+    return it->second;
+  }
+
+  std::optional<uint32_t> find(std::string_view name) const {
+    const auto it = ids_.find(name);
+    if (it == ids_.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  const std::string& name(uint32_t id) const { return names_[id]; }
+  size_t size() const { return names_.size(); }
+};
+
+}  // namespace models
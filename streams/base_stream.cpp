@@ -1,19 +1,59 @@
 #include "base_stream.hpp"
 
+#include <sys/socket.h>
+
+#include <algorithm>
+
 #include <quill/detail/LogMacros.h>
-#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/beast/core/tcp_stream.hpp>
+#include <boost/beast/http.hpp>
 #include <boost/json/parse.hpp>
 
+#include "feed.hpp"
+#include "perf.hpp"
+
 namespace stream {
 
+namespace {
+
+const auto kConflationReportPeriod = std::chrono::seconds(10);
+const auto kMinSnapshotBackoff = std::chrono::milliseconds(500);
+const auto kMaxSnapshotBackoff = std::chrono::milliseconds(30000);
+// whole REST request, from connect to the end of the response
+const auto kHttpTimeout = std::chrono::seconds(10);
+
+// Completes the asynchronous call started by `start` on `io_ctx`, which runs
+// nothing else. Throws on its error, or if `io_ctx` is stopped first.
+template <typename Start>
+void run_call(asio::io_context& io_ctx, Start&& start) {
+  bool done = false;
+  beast::error_code ec;
+  start([&done, &ec](beast::error_code result, auto&&...) {
+    ec = result;
+    done = true;
+  });
+  io_ctx.restart();
+  io_ctx.run();
+  if (!done) {
+    ec = asio::error::operation_aborted;
+  }
+  if (ec) {
+    throw beast::system_error(ec);
+  }
+}
+
+}  // namespace
+
 WebsocketBaseStream::WebsocketBaseStream(models::CoinContext& coin_ctx,
-                                         quill::Logger* const& main_logger)
-    : coin_ctx_(coin_ctx), main_logger_(main_logger) {
+                                         quill::Logger* const& main_logger,
+                                         std::stop_token stop)
+    : stop_(std::move(stop)), coin_ctx_(coin_ctx), main_logger_(main_logger) {
   LOG_INFO(main_logger_,
-           "Starting stream. [coin={:^6}; exchange={:^10}; domain={:^20}; "
-           "port={:^4}; target={:^30}]",
-           coin_ctx_.coin, coin_ctx_.exchange, coin_ctx_.domain, coin_ctx_.port,
-           coin_ctx_.target);
+           "Starting stream. [symbol={:^10}; exchange={:^10}; domain={:^20}; "
+           "port={:^4}; target={:^30}; busy_poll={}; cpu={}; conflate={}]",
+           coin_ctx_.symbol, coin_ctx_.exchange, coin_ctx_.domain, coin_ctx_.port,
+           coin_ctx_.target, coin_ctx_.options.busy_poll,
+           coin_ctx_.options.cpu, coin_ctx_.options.conflate);
 }
 
 void WebsocketBaseStream::connect_domain() {
@@ -21,6 +61,32 @@ void WebsocketBaseStream::connect_domain() {
   LOG_DEBUG(main_logger_, "Success resolve domain! {}", coin_ctx_.to_str());
   endpoint_ = asio::connect(get_lowest_layer(ws_), results);
   LOG_DEBUG(main_logger_, "Success connect domain! {}", coin_ctx_.to_str());
+  // runs on the thread that requests the stop, ::shutdown is safe beside a
+  // blocked read of the stream thread unlike the calls of the asio socket,
+  // and at once if the stop is already requested
+  on_stop_.emplace(stop_, [fd = get_lowest_layer(ws_).native_handle()] {
+    ::shutdown(fd, SHUT_RDWR);
+  });
+
+#ifdef SO_BUSY_POLL
+  if (coin_ctx_.options.busy_poll_us > 0) {
+    using busy_poll = asio::detail::socket_option::integer<SOL_SOCKET,
+                                                           SO_BUSY_POLL>;
+    // values above net.core.busy_poll need CAP_NET_ADMIN, the stream works
+    // without it
+    beast::error_code ec;
+    get_lowest_layer(ws_).set_option(
+        busy_poll(coin_ctx_.options.busy_poll_us), ec);
+    if (ec) {
+      LOG_WARNING(main_logger_, "Failed to set SO_BUSY_POLL={}us: {} {}",
+                  coin_ctx_.options.busy_poll_us, ec.message(),
+                  coin_ctx_.to_str());
+    } else {
+      LOG_DEBUG(main_logger_, "Success set SO_BUSY_POLL={}us! {}",
+                coin_ctx_.options.busy_poll_us, coin_ctx_.to_str());
+    }
+  }
+#endif
 }
 
 void WebsocketBaseStream::ssl_handshake() {
@@ -59,11 +125,11 @@ void WebsocketBaseStream::websocket_control_callback() {
   ws_.control_callback([this](const beast::websocket::frame_type& kind,
                               const boost::beast::string_view& payload) {
     if (kind == beast::websocket::frame_type::ping) {
-      LOG_INFO(this->coin_ctx_.logger, "Received ping frame! {}",
-               coin_ctx_.to_str());
+      LOG_DEBUG(this->main_logger_, "Received ping frame! {}",
+                coin_ctx_.to_str());
       this->ws_.pong(beast::websocket::ping_data(payload));
-      LOG_INFO(this->coin_ctx_.logger, "Success send pong frame! {}",
-               coin_ctx_.to_str());
+      LOG_DEBUG(this->main_logger_, "Success send pong frame! {}",
+                coin_ctx_.to_str());
     } else if (kind == beast::websocket::frame_type::pong) {
       LOG_WARNING(this->main_logger_, "Received pong frame! {}",
                   coin_ctx_.to_str());
@@ -74,24 +140,280 @@ void WebsocketBaseStream::websocket_control_callback() {
   });
 }
 
+void WebsocketBaseStream::read_frame() {
+  if (next_pending_) {
+    // the frame read_newest started to read
+    run_until(next_done_);
+    next_pending_ = false;
+    if (next_ec_) {
+      throw beast::system_error(next_ec_);
+    }
+    std::swap(buffer_, next_buffer_);
+    next_buffer_.clear();
+    return;
+  }
+  if (!coin_ctx_.options.busy_poll) {
+    ws_.read(buffer_);
+    return;
+  }
+
+  // Busy-poll receive: start an async read and spin on the io_context until
+  // it completes, so the thread never sleeps in the reactor.
+  beast::error_code ec;
+  bool done = false;
+  ws_.async_read(buffer_, [&ec, &done](beast::error_code result, size_t) {
+    ec = result;
+    done = true;
+  });
+  run_until(done);
+  if (ec) {
+    throw beast::system_error(ec);
+  }
+}
+
+void WebsocketBaseStream::run_until(const bool& done) {
+  io_ctx_.restart();
+  while (!done) {
+    if (coin_ctx_.options.busy_poll) {
+      io_ctx_.poll();
+    } else {
+      io_ctx_.run_one();
+    }
+  }
+}
+
+void WebsocketBaseStream::record_frame(const beast::flat_buffer& buffer) {
+  ++coin_ctx_.frames;
+  if (coin_ctx_.feed_writer) {
+    const auto data = buffer.cdata();
+    coin_ctx_.feed_writer->write(
+        coin_ctx_, feed::Channel::kIn,
+        std::string_view(static_cast<const char*>(data.data()), data.size()));
+  }
+}
+
+// Reads the next data frame into next_buffer_ if it is already received,
+// without blocking. Otherwise the read stays in flight for the next call or
+// read_frame, so a ping or close frame that arrived alone never blocks the
+// return of the newest snapshot.
+bool WebsocketBaseStream::poll_next_frame() {
+  if (!next_pending_) {
+    next_pending_ = true;
+    next_done_ = false;
+    ws_.async_read(next_buffer_, [this](beast::error_code ec, size_t) {
+      next_ec_ = ec;
+      next_done_ = true;
+    });
+  }
+  io_ctx_.restart();
+  while (!next_done_ && io_ctx_.poll()) {
+  }
+  if (!next_done_) {
+    return false;
+  }
+  next_pending_ = false;
+  if (next_ec_) {
+    throw beast::system_error(next_ec_);
+  }
+  return true;
+}
+
+// Every snapshot replaces the previous one, so after a stall the queued
+// frames are read without parsing and only the newest snapshot is returned.
+// Replies such as pongs are cheap to tell apart by a key of the raw frame, one
+// queued after the snapshot is dropped instead. All frames are still recorded
+// to the feed, an append to its buffer.
+boost::json::object WebsocketBaseStream::read_newest(
+    std::string_view snapshot_key) {
+  if (!coin_ctx_.options.conflate) {
+    return read();
+  }
+  const auto is_snapshot = [snapshot_key](const beast::flat_buffer& buffer) {
+    const auto data = buffer.cdata();
+    return std::string_view(static_cast<const char*>(data.data()),
+                            data.size())
+               .find(snapshot_key) != std::string_view::npos;
+  };
+
+  read_frame();
+  record_frame(buffer_);
+  uint32_t backlog = 0;
+  while (poll_next_frame()) {
+    record_frame(next_buffer_);
+    ++backlog;
+    if (is_snapshot(next_buffer_) || !is_snapshot(buffer_)) {
+      std::swap(buffer_, next_buffer_);
+    }
+    next_buffer_.clear();
+  }
+  coin_ctx_.conflated += backlog;
+  coin_ctx_.backlog = backlog;
+
+  report_frames_ += backlog + 1;
+  report_conflated_ += backlog;
+  report_max_backlog_ = std::max(report_max_backlog_, backlog);
+  if (std::chrono::steady_clock::now() - last_report_ >=
+      kConflationReportPeriod) {
+    report_conflation();
+  }
+  return parse_frame();
+}
+
+void WebsocketBaseStream::report_conflation() {
+  if (report_conflated_) {
+    LOG_INFO(main_logger_,
+             "Conflated frames. [frames={}; conflated={}; ratio={:.3f}; "
+             "max_backlog={}; conflated_total={}] {}",
+             report_frames_, report_conflated_,
+             double(report_conflated_) / report_frames_, report_max_backlog_,
+             coin_ctx_.conflated, coin_ctx_.to_str());
+  }
+  report_frames_ = 0;
+  report_conflated_ = 0;
+  report_max_backlog_ = 0;
+  last_report_ = std::chrono::steady_clock::now();
+}
+
 boost::json::object WebsocketBaseStream::read() {
-  ws_.read(buffer_);
-  const auto str = beast::buffers_to_string(buffer_.data());
-  LOG_INFO(coin_ctx_.logger, "[{:^10}] Received msg: {}", coin_ctx_.exchange,
-           str);
+  read_frame();
+  record_frame(buffer_);
+  return parse_frame();
+}
+
+boost::json::object WebsocketBaseStream::parse_frame() {
+  const auto data = buffer_.cdata();
+  const std::string_view str(static_cast<const char*>(data.data()),
+                             data.size());
+  perf::Scope scope(perf::Section::kDecode);
   return boost::json::parse(str).as_object();
 }
 
 void WebsocketBaseStream::clear_buffer() { buffer_.clear(); }
 
 void WebsocketBaseStream::write(const std::string& msg) {
-  LOG_INFO(coin_ctx_.logger, "[{:^10}] Starting send msg: {}",
-           coin_ctx_.exchange, msg);
-  ws_.write(asio::buffer(msg));
+  LOG_DEBUG(main_logger_, "Starting send msg: {} {}", msg, coin_ctx_.to_str());
+  if (coin_ctx_.feed_writer) {
+    coin_ctx_.feed_writer->write(coin_ctx_, feed::Channel::kOut, msg);
+  }
+  if (!next_pending_) {
+    ws_.write(asio::buffer(msg));
+    return;
+  }
+
+  // a read of read_newest is in flight, beast allows one async write beside it
+  beast::error_code ec;
+  bool done = false;
+  ws_.async_write(asio::buffer(msg),
+                  [&ec, &done](beast::error_code result, size_t) {
+                    ec = result;
+                    done = true;
+                  });
+  run_until(done);
+  if (ec) {
+    throw beast::system_error(ec);
+  }
+}
+
+boost::json::value WebsocketBaseStream::http_get(const std::string& domain,
+                                                const std::string& target) {
+  static const std::string kPort = "443";
+
+  // a context of its own, the timer of tcp_stream only applies to
+  // asynchronous calls and the websocket is not run meanwhile
+  asio::io_context io_ctx;
+  std::stop_callback on_stop(stop_, [&io_ctx] { io_ctx.stop(); });
+  beast::ssl_stream<beast::tcp_stream> stream(io_ctx, ssl_ctx_);
+  if (!SSL_set_tlsext_host_name(stream.native_handle(), domain.c_str()))
+    throw beast::system_error(
+        beast::error_code(static_cast<int>(::ERR_get_error()),
+                          asio::error::get_ssl_category()),
+        "Failed to set SNI Hostname");
+  auto& socket = beast::get_lowest_layer(stream);
+  socket.expires_after(kHttpTimeout);  // one deadline for all the calls
+  const auto endpoints = resolver_.resolve(domain, kPort);
+  run_call(io_ctx, [&](auto handler) {
+    socket.async_connect(endpoints, std::move(handler));
+  });
+  run_call(io_ctx, [&](auto handler) {
+    stream.async_handshake(asio::ssl::stream_base::client, std::move(handler));
+  });
+
+  beast::http::request<beast::http::empty_body> req{beast::http::verb::get,
+                                                    target, 11};
+  req.set(beast::http::field::host, domain);
+  req.set(beast::http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+  run_call(io_ctx, [&](auto handler) {
+    beast::http::async_write(stream, req, std::move(handler));
+  });
+
+  beast::flat_buffer buffer;
+  beast::http::response<beast::http::string_body> res;
+  run_call(io_ctx, [&](auto handler) {
+    beast::http::async_read(stream, buffer, res, std::move(handler));
+  });
+  LOG_DEBUG(main_logger_, "GET {}{} -> {} {}", domain, target,
+            res.result_int(), coin_ctx_.to_str());
+
+  // servers often drop the connection without close
+  stream.async_shutdown([](beast::error_code) {});
+  io_ctx.restart();
+  io_ctx.run();
+
+  if (res.result() != beast::http::status::ok) {
+    throw std::runtime_error(fmt::format("GET {}{} failed: {} {}", domain,
+                                         target, res.result_int(),
+                                         res.body()));
+  }
+  // recorded in order with the frames, so replays can rebuild the book
+  if (coin_ctx_.feed_writer) {
+    coin_ctx_.feed_writer->write(coin_ctx_, feed::Channel::kIn, res.body());
+  }
+  return boost::json::parse(res.body());
+}
+
+bool WebsocketBaseStream::snapshot_due() const {
+  return std::chrono::steady_clock::now() >= next_snapshot_;
+}
+
+// A rate limit (HTTP 429) or a network error must not end the stream, the
+// book stays out of sync and the next diff after the backoff retries. A
+// snapshot that does not bring the book back in sequence, e.g. older than the
+// stream, backs off the next request as well.
+std::optional<boost::json::object> WebsocketBaseStream::fetch_snapshot() {
+  snapshot_backoff_ = std::clamp(snapshot_backoff_ * 2, kMinSnapshotBackoff,
+                                 kMaxSnapshotBackoff);
+  next_snapshot_ = std::chrono::steady_clock::now() + snapshot_backoff_;
+  try {
+    return http_get(coin_ctx_.snapshot_domain, coin_ctx_.snapshot_target)
+        .as_object();
+  } catch (const std::exception& e) {
+    LOG_WARNING(main_logger_, "Failed to get snapshot, retry in {}ms: {} {}",
+                snapshot_backoff_.count(), e.what(), coin_ctx_.to_str());
+    return std::nullopt;
+  }
+}
+
+void WebsocketBaseStream::on_book_synced() {
+  snapshot_backoff_ = std::chrono::milliseconds(0);
+  next_snapshot_ = {};
 }
 
 WebsocketBaseStream::~WebsocketBaseStream() {
-  ws_.close(beast::websocket::close_code::normal);
+  on_stop_.reset();
+  beast::error_code ec;
+  if (next_pending_ || stopped() || !ws_.is_open()) {
+    // the read in flight or the shut down socket can not complete a close
+    // handshake
+    get_lowest_layer(ws_).close(ec);
+    LOG_INFO(main_logger_, "Success closed socket! {}", coin_ctx_.to_str());
+    return;
+  }
+  ws_.close(beast::websocket::close_code::normal, ec);
+  if (ec) {
+    LOG_WARNING(main_logger_, "Failed to close websocket: {} {}", ec.message(),
+                coin_ctx_.to_str());
+    return;
+  }
   LOG_INFO(main_logger_, "Success closed websocket! {}", coin_ctx_.to_str());
 }
 
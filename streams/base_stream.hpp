@@ -1,10 +1,17 @@
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <stop_token>
+#include <string_view>
+
 #include <quill/Logger.h>
 #include <boost/asio/connect.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/beast/websocket.hpp>
+#include <boost/json/object.hpp>
 #include <boost/json/value.hpp>
 
 #include "context.hpp"
@@ -24,6 +31,28 @@ class WebsocketBaseStream : private boost::noncopyable {
   beast::websocket::stream<beast::ssl_stream<asio::ip::tcp::socket>> ws_{
       io_ctx_, ssl_ctx_};
   beast::flat_buffer buffer_;
+  // conflation: the read of the frame after buffer_, started by read_newest,
+  // completed there if the frame is already received or by the next read
+  beast::flat_buffer next_buffer_;
+  bool next_pending_ = false;
+  bool next_done_ = false;
+  beast::error_code next_ec_;
+
+  // REST snapshots are not requested before this time after a request,
+  // until the book is back in sequence
+  std::chrono::milliseconds snapshot_backoff_{0};
+  std::chrono::steady_clock::time_point next_snapshot_{};
+
+  // conflation counters since the last report
+  uint64_t report_frames_ = 0;
+  uint64_t report_conflated_ = 0;
+  uint32_t report_max_backlog_ = 0;
+  std::chrono::steady_clock::time_point last_report_ =
+      std::chrono::steady_clock::now();
+
+  // a stop request shuts the socket down, the blocked read fails
+  std::stop_token stop_;
+  std::optional<std::stop_callback<std::function<void()>>> on_stop_;
 
   models::CoinContext& coin_ctx_;
 
@@ -32,18 +61,48 @@ class WebsocketBaseStream : private boost::noncopyable {
  public:
   WebsocketBaseStream() = delete;
   explicit WebsocketBaseStream(models::CoinContext& coin_ctx,
-                               quill::Logger* const& main_logger);
+                               quill::Logger* const& main_logger,
+                               std::stop_token stop = {});
 
   void connect_domain();
+  // True once the owner asked the stream to stop, reads fail after that.
+  bool stopped() const { return stop_.stop_requested(); }
   void ssl_handshake();
   void websocket_handshake();
   void websocket_control_callback();
 
   boost::json::object read();
+  // Like read, but with ExchangeOptions::conflate the frames already received
+  // behind the next one are skipped and the newest snapshot, a frame that
+  // contains `snapshot_key`, is returned. Without a snapshot among them the
+  // newest frame is returned.
+  boost::json::object read_newest(std::string_view snapshot_key);
   void clear_buffer();
   void write(const std::string& msg);
 
+  // One-shot HTTPS GET on a separate connection, for REST snapshots. Fails
+  // after 10 seconds or on a stop request.
+  boost::json::value http_get(const std::string& domain,
+                              const std::string& target);
+  // False while the backoff of the last snapshot request lasts.
+  bool snapshot_due() const;
+  // REST snapshot of the diff book of the context, std::nullopt if the
+  // request failed. Failures are logged. Every request backs off the next
+  // one until on_book_synced.
+  std::optional<boost::json::object> fetch_snapshot();
+  // The diff book is in sequence again, the next resync requests a snapshot
+  // at once.
+  void on_book_synced();
+
   ~WebsocketBaseStream();
+
+ private:
+  void read_frame();
+  void record_frame(const beast::flat_buffer& buffer);
+  boost::json::object parse_frame();
+  bool poll_next_frame();
+  void run_until(const bool& done);
+  void report_conflation();
 };
 
 }  // namespace stream
\ No newline at end of file
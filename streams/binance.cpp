@@ -1,60 +1,134 @@
 #include "binance.hpp"
 
+#include <optional>
+
 #include <quill/detail/LogMacros.h>
 #include <boost/json/parse.hpp>
 #include <boost/json/serialize.hpp>
 
 #include "base_stream.hpp"
+#include "perf.hpp"
 
 namespace stream {
 
 namespace {
 
-void fill_bid(const boost::json::object& obj, models::CoinContext& coin_ctx) {
-  const auto bids = obj.at("b").as_array();
-  if (bids.size()) {
-    coin_ctx.bid_pure = std::stold(bids.at(0).at(0).as_string().c_str());
-    coin_ctx.bid = coin_ctx.bid_pure * (1. + coin_ctx.comm_taker * 0.01);
-  }
+// key of the raw depth frames, see WebsocketBaseStream::read_newest
+const std::string kSnapshotKey = R"("e":"depthUpdate")";
+
+// An empty side keeps its last price.
+void fill_top(const boost::json::object& obj, models::CoinContext& coin_ctx) {
+  const auto& bids = obj.at("b").as_array();
+  const auto& asks = obj.at("a").as_array();
+  coin_ctx.set_top(
+      bids.size() ? std::stold(bids.at(0).at(0).as_string().c_str())
+                  : coin_ctx.bid_pure,
+      asks.size() ? std::stold(asks.at(0).at(0).as_string().c_str())
+                  : coin_ctx.ask_pure);
 }
 
-void fill_ask(const boost::json::object& obj, models::CoinContext& coin_ctx) {
-  const auto asks = obj.at("a").as_array();
-  if (asks.size()) {
-    coin_ctx.ask_pure = std::stold(asks.at(0).at(0).as_string().c_str());
-    coin_ctx.ask = coin_ctx.ask_pure * (1. - coin_ctx.comm_maker * 0.01);
+void fill_levels(const boost::json::array& bids, const boost::json::array& asks,
+                 models::OrderBook& book) {
+  for (const auto& level : bids) {
+    book.set_bid(std::stold(level.at(0).as_string().c_str()),
+                 std::stold(level.at(1).as_string().c_str()));
+  }
+  for (const auto& level : asks) {
+    book.set_ask(std::stold(level.at(0).as_string().c_str()),
+                 std::stold(level.at(1).as_string().c_str()));
   }
 }
 
 }  // namespace
 
+// Diff depth: https://binance-docs.github.io/apidocs/futures/en/#how-to-manage-a-local-order-book-correctly
+FrameResult ApplyBinanceFrame(const boost::json::object& obj,
+                              models::CoinContext& coin_ctx, DiffBook* diff) {
+  if (!obj.contains("e") || obj.at("e") != "depthUpdate") {
+    return FrameResult::kOther;
+  }
+
+  if (diff) {
+    const auto action =
+        diff->sync.check(obj.at("U").as_int64(), obj.at("u").as_int64(),
+                         obj.at("pu").as_int64());
+    if (action != BookSync::Action::kApply) {
+      return ToFrameResult(action);
+    }
+    perf::Scope scope(perf::Section::kBinance);
+    fill_levels(obj.at("b").as_array(), obj.at("a").as_array(), diff->book);
+    FillTop(diff->book, coin_ctx);
+  } else {
+    perf::Scope scope(perf::Section::kBinance);
+    fill_top(obj, coin_ctx);
+  }
+
+  const auto timestamp = obj.at("E").as_int64();
+  coin_ctx.ask_time = TimePoint(std::chrono::milliseconds(timestamp));
+  coin_ctx.bid_time = coin_ctx.ask_time;
+  return FrameResult::kUpdate;
+}
+
+bool IsBinanceSnapshot(const boost::json::object& obj) {
+  return obj.contains("lastUpdateId");
+}
+
+void LoadBinanceSnapshot(const boost::json::object& snapshot, DiffBook& diff) {
+  diff.book.clear();
+  fill_levels(snapshot.at("bids").as_array(), snapshot.at("asks").as_array(),
+              diff.book);
+  diff.sync.on_snapshot(snapshot.at("lastUpdateId").as_int64());
+}
+
 void RunBinanceStream(models::CoinContext& coin_ctx,
-                      quill::Logger* const& main_logger) {
-  WebsocketBaseStream ws(coin_ctx, main_logger);
+                      quill::Logger* const& main_logger,
+                      std::stop_token stop) {
+  WebsocketBaseStream ws(coin_ctx, main_logger, std::move(stop));
   ws.connect_domain();
   ws.ssl_handshake();
   ws.websocket_handshake();
   ws.websocket_control_callback();
 
-  while (true) {
-    const auto obj = ws.read();
-    if (obj.contains("e") && obj.at("e") == "depthUpdate") {
-      fill_bid(obj, coin_ctx);
-      fill_ask(obj, coin_ctx);
+  // the first event must contain lastUpdateId, every next continues "pu"
+  std::optional<DiffBook> diff;
+  if (coin_ctx.options.diff_depth) {
+    diff.emplace(0);
+  }
 
-      if (coin_ctx.bid > 0 && coin_ctx.ask > 0) {
-        LOG_DEBUG(coin_ctx.logger, "[bid={}; ask={}; exchange={}]",
-                  coin_ctx.bid, coin_ctx.ask, coin_ctx.exchange);
+  while (!ws.stopped()) {
+    const auto obj = ws.read_newest(kSnapshotKey);
+    ws.clear_buffer();
+    auto result = ApplyBinanceFrame(obj, coin_ctx, diff ? &*diff : nullptr);
+    // one request per backoff, until the book is back in sequence
+    if (result == FrameResult::kResync && ws.snapshot_due()) {
+      LOG_WARNING(main_logger,
+                  "{} Resync book. [U={}; u={}; pu={}; resyncs={}]",
+                  coin_ctx.to_str(), obj.at("U").as_int64(),
+                  obj.at("u").as_int64(), obj.at("pu").as_int64(),
+                  ++diff->resyncs);
+      if (const auto snapshot = ws.fetch_snapshot()) {
+        LoadBinanceSnapshot(*snapshot, *diff);
+        result = ApplyBinanceFrame(obj, coin_ctx, &*diff);
       }
-
-      const auto timestamp = obj.at("E").as_int64();
-      coin_ctx.ask_time = TimePoint(std::chrono::milliseconds(timestamp));
-      coin_ctx.bid_time = coin_ctx.ask_time;
-    } else {
+    }
+    if (result == FrameResult::kOther) {
       LOG_WARNING(main_logger, "{} unknown msg received: {}", coin_ctx.to_str(),
                   boost::json::serialize(obj));
+      continue;
     }
-    ws.clear_buffer();
+    if (result != FrameResult::kUpdate) {
+      continue;
+    }
+    if (diff) {
+      ws.on_book_synced();
+    }
+
+    if (coin_ctx.bid > 0 && coin_ctx.ask > 0) {
+      LOG_DEBUG(main_logger, "[bid={}; ask={}; depth={}] {}", coin_ctx.bid,
+                coin_ctx.ask, diff ? diff->book.depth() : 0,
+                coin_ctx.to_str());
+    }
+    coin_ctx.notify();
   }
 }
 
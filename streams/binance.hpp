@@ -1,12 +1,28 @@
 #pragma once
 
+#include <stop_token>
+
 #include <quill/Logger.h>
+#include <boost/json/object.hpp>
 
+#include "book_sync.hpp"
 #include "context.hpp"
 
 namespace stream {
 
+// Runs until the connection fails or `stop` is requested, which shuts the
+// socket down, so the pending read throws.
 void RunBinanceStream(models::CoinContext& coin_ctx,
-                      quill::Logger* const& main_logger);
+                      quill::Logger* const& main_logger,
+                      std::stop_token stop = {});
+
+// Frame handling of the stream without the connection, shared with replays
+// of the recorded feed. `diff` is the local book in diff depth mode, nullptr
+// in snapshot mode.
+FrameResult ApplyBinanceFrame(const boost::json::object& obj,
+                              models::CoinContext& coin_ctx, DiffBook* diff);
+// REST depth snapshot of the diff depth mode.
+bool IsBinanceSnapshot(const boost::json::object& obj);
+void LoadBinanceSnapshot(const boost::json::object& snapshot, DiffBook& diff);
 
 }  // namespace stream
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+
+#include "context.hpp"
+#include "order_book.hpp"
+
+namespace stream {
+
+// Sequencing of a diff depth stream against REST snapshots of the book.
+// Events carry the range [first_id, last_id] of updates they contain and the
+// id they continue (`prev_id`), exchanges differ only in how those are named.
+class BookSync {
+ public:
+  enum class Action {
+    kApply,   // the event continues the book
+    kSkip,    // the event is already in the snapshot
+    kResync,  // a new snapshot is required
+  };
+
+ private:
+  int64_t snapshot_id_ = -1;  // -1 - no snapshot
+  int64_t last_id_ = -1;      // -1 - the first event is not applied yet
+  // the first applied event must contain snapshot_id + offset
+  const int64_t offset_;
+
+ public:
+  explicit BookSync(int64_t offset) : offset_(offset) {}
+
+  void on_snapshot(int64_t snapshot_id) {
+    snapshot_id_ = snapshot_id;
+    last_id_ = -1;
+  }
+
+  Action check(int64_t first_id, int64_t last_id, int64_t prev_id) {
+    if (last_id_ >= 0) {
+      if (prev_id != last_id_) {
+        snapshot_id_ = -1;
+        last_id_ = -1;
+        return Action::kResync;
+      }
+      last_id_ = last_id;
+      return Action::kApply;
+    }
+
+    if (snapshot_id_ < 0) {
+      return Action::kResync;
+    }
+    const auto target = snapshot_id_ + offset_;
+    if (last_id < target) {
+      return Action::kSkip;
+    }
+    if (first_id > target) {
+      // the snapshot is older than the stream
+      snapshot_id_ = -1;
+      return Action::kResync;
+    }
+    last_id_ = last_id;
+    return Action::kApply;
+  }
+};
+
+// Local book of a diff depth stream.
+struct DiffBook {
+  models::OrderBook book;
+  BookSync sync;
+  uint64_t resyncs = 0;
+
+  explicit DiffBook(int64_t offset) : sync(offset) {}
+};
+
+// Outcome of one frame of a stream, see Apply*Frame.
+enum class FrameResult {
+  kUpdate,  // the quote of the context changed
+  kSkip,    // the diff is already in the book
+  kResync,  // the diff book needs a REST snapshot first
+  kOther,   // not a depth frame
+};
+
+inline FrameResult ToFrameResult(BookSync::Action action) {
+  switch (action) {
+    case BookSync::Action::kApply:
+      return FrameResult::kUpdate;
+    case BookSync::Action::kSkip:
+      return FrameResult::kSkip;
+    case BookSync::Action::kResync:
+      return FrameResult::kResync;
+  }
+  return FrameResult::kOther;
+}
+
+// Top of the book with commissions to the context of the stream.
+inline void FillTop(const models::OrderBook& book,
+                    models::CoinContext& coin_ctx) {
+  coin_ctx.set_top(book.best_bid(), book.best_ask());
+}
+
+}  // namespace stream
@@ -1,6 +1,7 @@
 #include "gateio.hpp"
 
 #include <algorithm>
+#include <optional>
 
 #include <quill/detail/LogMacros.h>
 #include <boost/algorithm/string/replace.hpp>
@@ -8,6 +9,7 @@
 #include <boost/json/serialize.hpp>
 
 #include "base_stream.hpp"
+#include "perf.hpp"
 
 namespace stream {
 
@@ -17,10 +19,21 @@ const std::string kInitMsgTemplate = R"({
   "channel" : "futures.book_ticker",
   "event": "subscribe",
   "payload" : [
-    "{}_USDT"
+    "{}"
   ]
 })";
 
+const std::string kDiffInitMsgTemplate = R"({
+  "channel" : "futures.order_book_update",
+  "event": "subscribe",
+  "payload" : [
+    "{}", "100ms", "100"
+  ]
+})";
+
+// key of the raw book ticker frames, see WebsocketBaseStream::read_newest
+const std::string kSnapshotKey = R"("event":"update")";
+
 // enum class PureType {
 //   kAsk,
 //   kBid,
@@ -38,76 +51,152 @@ const std::string kInitMsgTemplate = R"({
 //   return *std::max_element(v.begin(), v.end());
 // }
 
-void fill_bid(const boost::json::object& obj, models::CoinContext& coin_ctx) {
-  const auto bid = obj.at("result").at("b").as_string().c_str();
-  const auto size = obj.at("result").at("B").as_int64();
-  if (size > 0) {
-    coin_ctx.bid_pure = -1;
-    coin_ctx.bid = -1;
-  } else {
-    coin_ctx.bid_pure = std::stold(bid);
-    coin_ctx.bid = coin_ctx.bid_pure * (1. + coin_ctx.comm_taker * 0.01);
+void fill_top(const boost::json::object& obj, models::CoinContext& coin_ctx) {
+  const auto& result = obj.at("result");
+  coin_ctx.set_top(
+      result.at("B").as_int64() > 0
+          ? -1
+          : std::stold(result.at("b").as_string().c_str()),
+      result.at("A").as_int64() > 0
+          ? -1
+          : std::stold(result.at("a").as_string().c_str()));
+}
+
+Money to_money(const boost::json::value& value) {
+  if (value.is_string()) {
+    return std::stold(value.as_string().c_str());
+  } else if (value.if_double()) {
+    return value.as_double();
   }
+  return value.as_int64();
 }
 
-void fill_ask(const boost::json::object& obj, models::CoinContext& coin_ctx) {
-  const auto ask = obj.at("result").at("a").as_string().c_str();
-  const auto size = obj.at("result").at("A").as_int64();
-  if (size > 0) {
-    coin_ctx.ask_pure = -1;
-    coin_ctx.ask = -1;
-  } else {
-    coin_ctx.ask_pure = std::stold(ask);
-    coin_ctx.ask = coin_ctx.ask_pure * (1. - coin_ctx.comm_maker * 0.01);
+// level: {"p": price, "s": size}
+void fill_levels(const boost::json::array& bids, const boost::json::array& asks,
+                 models::OrderBook& book) {
+  for (const auto& level : bids) {
+    book.set_bid(to_money(level.at("p")), to_money(level.at("s")));
+  }
+  for (const auto& level : asks) {
+    book.set_ask(to_money(level.at("p")), to_money(level.at("s")));
   }
 }
 
 }  // namespace
 
+FrameResult ApplyGateFrame(const boost::json::object& obj,
+                           models::CoinContext& coin_ctx, DiffBook* diff) {
+  const char* channel =
+      diff ? "futures.order_book_update" : "futures.book_ticker";
+  if (!obj.contains("channel") || obj.at("channel") != channel ||
+      obj.at("event") != "update") {
+    return FrameResult::kOther;
+  }
+
+  if (diff) {
+    // the first event must contain snapshot id + 1, every next starts with
+    // the last id + 1
+    const auto& result = obj.at("result").as_object();
+    const auto first_id = result.at("U").as_int64();
+    const auto action =
+        diff->sync.check(first_id, result.at("u").as_int64(), first_id - 1);
+    if (action != BookSync::Action::kApply) {
+      return ToFrameResult(action);
+    }
+    perf::Scope scope(perf::Section::kGate);
+    fill_levels(result.at("b").as_array(), result.at("a").as_array(),
+                diff->book);
+    FillTop(diff->book, coin_ctx);
+  } else {
+    perf::Scope scope(perf::Section::kGate);
+    fill_top(obj, coin_ctx);
+  }
+
+  const auto timestamp = obj.at("result").at("t").as_int64();
+  coin_ctx.ask_time = TimePoint(std::chrono::milliseconds(timestamp));
+  coin_ctx.bid_time = coin_ctx.ask_time;
+  return FrameResult::kUpdate;
+}
+
+bool IsGateSnapshot(const boost::json::object& obj) {
+  return obj.contains("current") && obj.contains("asks") &&
+         !obj.contains("channel");
+}
+
+void LoadGateSnapshot(const boost::json::object& snapshot, DiffBook& diff) {
+  diff.book.clear();
+  fill_levels(snapshot.at("bids").as_array(), snapshot.at("asks").as_array(),
+              diff.book);
+  diff.sync.on_snapshot(snapshot.at("id").as_int64());
+}
+
 void RunGateStream(models::CoinContext& coin_ctx,
-                   quill::Logger* const& main_logger) {
-  WebsocketBaseStream ws(coin_ctx, main_logger);
+                   quill::Logger* const& main_logger,
+                   std::stop_token stop) {
+  WebsocketBaseStream ws(coin_ctx, main_logger, std::move(stop));
   ws.connect_domain();
   ws.ssl_handshake();
   ws.websocket_handshake();
   ws.websocket_control_callback();
 
-  const auto init_msg =
-      boost::replace_first_copy(kInitMsgTemplate, "{}", coin_ctx.coin);
+  std::optional<DiffBook> diff;
+  if (coin_ctx.options.diff_depth) {
+    diff.emplace(1);
+  }
+  const char* channel =
+      diff ? "futures.order_book_update" : "futures.book_ticker";
+
+  const auto init_msg = boost::replace_first_copy(
+      diff ? kDiffInitMsgTemplate : kInitMsgTemplate, "{}", coin_ctx.symbol);
   ws.write(init_msg);
 
-  while (true) {
+  {
     const auto obj = ws.read();
-    if (obj.contains("channel") && obj.at("channel") == "futures.book_ticker") {
-      if (obj.at("event") == "update") {
-        fill_bid(obj, coin_ctx);
-        fill_ask(obj, coin_ctx);
-
-        if (coin_ctx.bid > 0 && coin_ctx.ask > 0) {
-          LOG_DEBUG(coin_ctx.logger, "[bid={}; ask={}; exchange={}]",
-                    coin_ctx.bid, coin_ctx.ask, coin_ctx.exchange);
-        }
-
-        const auto timestamp = obj.at("result").at("t").as_int64();
-        coin_ctx.ask_time = TimePoint(std::chrono::milliseconds(timestamp));
-        coin_ctx.bid_time = coin_ctx.ask_time;
-
-      } else if (obj.at("event") == "subscribe") {
-        if (obj.at("result").if_object() &&
-            obj.at("result").at("status") == "success") {
-          LOG_DEBUG(main_logger, "{} Subscribe success", coin_ctx.to_str());
-        } else {
-          LOG_ERROR(main_logger, "{} {}", coin_ctx.to_str(),
-                    obj.at("error").at("message").as_string().c_str());
-          break;
-        }
-      }
+    if (obj.contains("channel") && obj.at("channel") == channel &&
+        obj.at("event") == "subscribe" && obj.at("result").if_object() &&
+        obj.at("result").at("status") == "success") {
+      LOG_DEBUG(main_logger, "{} Subscribe success", coin_ctx.to_str());
     } else {
-      LOG_WARNING(main_logger, "{} unknown msg received: {}", coin_ctx.to_str(),
-                  boost::json::serialize(obj));
+      LOG_ERROR(main_logger, "{} Subscribe {}", coin_ctx.to_str(),
+                boost::json::serialize(obj));
+      return;
     }
     ws.clear_buffer();
   }
+
+  while (!ws.stopped()) {
+    const auto obj = ws.read_newest(kSnapshotKey);
+    ws.clear_buffer();
+    auto result = ApplyGateFrame(obj, coin_ctx, diff ? &*diff : nullptr);
+    // one request per backoff, until the book is back in sequence
+    if (result == FrameResult::kResync && ws.snapshot_due()) {
+      LOG_WARNING(main_logger, "{} Resync book. [U={}; u={}; resyncs={}]",
+                  coin_ctx.to_str(), obj.at("result").at("U").as_int64(),
+                  obj.at("result").at("u").as_int64(), ++diff->resyncs);
+      if (const auto snapshot = ws.fetch_snapshot()) {
+        LoadGateSnapshot(*snapshot, *diff);
+        result = ApplyGateFrame(obj, coin_ctx, &*diff);
+      }
+    }
+
+    if (result == FrameResult::kOther) {
+      LOG_WARNING(main_logger, "{} unknown msg received: {}",
+                  coin_ctx.to_str(), boost::json::serialize(obj));
+      continue;
+    }
+    if (result != FrameResult::kUpdate) {
+      continue;
+    }
+    if (diff) {
+      ws.on_book_synced();
+    }
+
+    if (coin_ctx.bid > 0 && coin_ctx.ask > 0) {
+      LOG_DEBUG(main_logger, "[bid={}; ask={}] {}", coin_ctx.bid, coin_ctx.ask,
+                coin_ctx.to_str());
+    }
+    coin_ctx.notify();
+  }
 }
 
 }  // namespace stream
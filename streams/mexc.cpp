@@ -1,6 +1,7 @@
 #include "mexc.hpp"
 
 #include <chrono>
+#include <optional>
 
 #include <quill/detail/LogMacros.h>
 #include <boost/algorithm/string/replace.hpp>
@@ -8,6 +9,7 @@
 #include <boost/json/serialize.hpp>
 
 #include "base_stream.hpp"
+#include "perf.hpp"
 
 namespace stream {
 
@@ -16,36 +18,48 @@ namespace {
 const std::string kInitMsgTemplate = R"({
   "method": "sub.depth.full",
   "param": {
-    "symbol": "{}_USDT",
+    "symbol": "{}",
     "limit": 20
   }
 })";
 
+const std::string kDiffInitMsgTemplate = R"({
+  "method": "sub.depth",
+  "param": {
+    "symbol": "{}"
+  }
+})";
+
 const std::string kPingMsg = R"({
   "method": "ping"
 })";
 
-void fill_bid(const boost::json::object& obj, models::CoinContext& coin_ctx) {
-  const auto bids = obj.at("data").at("bids").as_array();
-  if (bids.size()) {
-    if (bids.at(0).at(0).if_double()) {
-      coin_ctx.bid_pure = bids.at(0).at(0).as_double();
-    } else {
-      coin_ctx.bid_pure = bids.at(0).at(0).as_int64();
-    }
-    coin_ctx.bid = coin_ctx.bid_pure * (1. + coin_ctx.comm_taker * 0.01);
+// key of the raw depth frames, see WebsocketBaseStream::read_newest
+const std::string kSnapshotKey = R"("channel":"push.depth.full")";
+
+Money to_money(const boost::json::value& value) {
+  if (value.if_double()) {
+    return value.as_double();
   }
+  return value.as_int64();
 }
 
-void fill_ask(const boost::json::object& obj, models::CoinContext& coin_ctx) {
-  const auto asks = obj.at("data").at("asks").as_array();
-  if (asks.size()) {
-    if (asks.at(0).at(0).if_double()) {
-      coin_ctx.ask_pure = asks.at(0).at(0).as_double();
-    } else {
-      coin_ctx.ask_pure = asks.at(0).at(0).as_int64();
-    }
-    coin_ctx.ask = coin_ctx.ask_pure * (1. - coin_ctx.comm_maker * 0.01);
+// An empty side keeps its last price.
+void fill_top(const boost::json::object& obj, models::CoinContext& coin_ctx) {
+  const auto& data = obj.at("data");
+  const auto& bids = data.at("bids").as_array();
+  const auto& asks = data.at("asks").as_array();
+  coin_ctx.set_top(bids.size() ? to_money(bids.at(0).at(0)) : coin_ctx.bid_pure,
+                   asks.size() ? to_money(asks.at(0).at(0)) : coin_ctx.ask_pure);
+}
+
+// level: [price, volume, orders]
+void fill_levels(const boost::json::object& data, models::OrderBook& book) {
+  for (const auto& level : data.at("bids").as_array()) {
+    book.set_bid(to_money(level.at(0)), to_money(level.at(1)));
+  }
+  for (const auto& level : data.at("asks").as_array()) {
+    book.set_ask(to_money(level.at(0)), to_money(level.at(1)));
   }
 }
 
@@ -61,9 +75,51 @@ bool check_deadline(std::chrono::steady_clock::time_point& prev_tp) {
 
 }  // namespace
 
+FrameResult ApplyMexcFrame(const boost::json::object& obj,
+                           models::CoinContext& coin_ctx, DiffBook* diff) {
+  const char* push_channel = diff ? "push.depth" : "push.depth.full";
+  if (!obj.contains("channel") || obj.at("channel") != push_channel) {
+    return FrameResult::kOther;
+  }
+
+  if (diff) {
+    // versions go one by one, the first event follows the snapshot version
+    const auto& data = obj.at("data").as_object();
+    const auto version = data.at("version").as_int64();
+    const auto action = diff->sync.check(version, version, version - 1);
+    if (action != BookSync::Action::kApply) {
+      return ToFrameResult(action);
+    }
+    perf::Scope scope(perf::Section::kMexc);
+    fill_levels(data, diff->book);
+    FillTop(diff->book, coin_ctx);
+  } else {
+    perf::Scope scope(perf::Section::kMexc);
+    fill_top(obj, coin_ctx);
+  }
+
+  const auto timestamp = obj.at("ts").as_int64();
+  coin_ctx.ask_time = TimePoint(std::chrono::milliseconds(timestamp));
+  coin_ctx.bid_time = coin_ctx.ask_time;
+  return FrameResult::kUpdate;
+}
+
+bool IsMexcSnapshot(const boost::json::object& obj) {
+  return obj.contains("success") && obj.contains("data") &&
+         !obj.contains("channel");
+}
+
+void LoadMexcSnapshot(const boost::json::object& snapshot, DiffBook& diff) {
+  const auto& data = snapshot.at("data").as_object();
+  diff.book.clear();
+  fill_levels(data, diff.book);
+  diff.sync.on_snapshot(data.at("version").as_int64());
+}
+
 void RunMexcStream(models::CoinContext& coin_ctx,
-                   quill::Logger* const& main_logger) {
-  WebsocketBaseStream ws(coin_ctx, main_logger);
+                   quill::Logger* const& main_logger,
+                   std::stop_token stop) {
+  WebsocketBaseStream ws(coin_ctx, main_logger, std::move(stop));
   ws.connect_domain();
   ws.ssl_handshake();
   ws.websocket_handshake();
@@ -71,13 +127,19 @@ void RunMexcStream(models::CoinContext& coin_ctx,
 
   auto time_point = std::chrono::steady_clock::now();
 
-  const auto init_msg =
-      boost::replace_first_copy(kInitMsgTemplate, "{}", coin_ctx.coin);
+  std::optional<DiffBook> diff;
+  if (coin_ctx.options.diff_depth) {
+    diff.emplace(1);
+  }
+  const char* sub_channel = diff ? "rs.sub.depth" : "rs.sub.depth.full";
+
+  const auto init_msg = boost::replace_first_copy(
+      diff ? kDiffInitMsgTemplate : kInitMsgTemplate, "{}", coin_ctx.symbol);
   ws.write(init_msg);
 
   {
     const auto obj = ws.read();
-    if (obj.at("channel") == "rs.sub.depth.full" &&
+    if (obj.at("channel") == sub_channel &&
         obj.at("data") == "success") {
       LOG_DEBUG(main_logger, "{} Subscribe success", coin_ctx.to_str());
     } else {
@@ -88,31 +150,47 @@ void RunMexcStream(models::CoinContext& coin_ctx,
     ws.clear_buffer();
   }
 
-  while (true) {
+  while (!ws.stopped()) {
     if (check_deadline(time_point)) {
       ws.write(kPingMsg);
     }
 
-    const auto obj = ws.read();
-    if (obj.contains("channel") && obj.at("channel") == "push.depth.full") {
-      fill_bid(obj, coin_ctx);
-      fill_ask(obj, coin_ctx);
+    const auto obj = ws.read_newest(kSnapshotKey);
+    ws.clear_buffer();
+    auto result = ApplyMexcFrame(obj, coin_ctx, diff ? &*diff : nullptr);
+    // one request per backoff, until the book is back in sequence
+    if (result == FrameResult::kResync && ws.snapshot_due()) {
+      LOG_WARNING(main_logger, "{} Resync book. [version={}; resyncs={}]",
+                  coin_ctx.to_str(), obj.at("data").at("version").as_int64(),
+                  ++diff->resyncs);
+      if (const auto snapshot = ws.fetch_snapshot()) {
+        LoadMexcSnapshot(*snapshot, *diff);
+        result = ApplyMexcFrame(obj, coin_ctx, &*diff);
+      }
+    }
 
-      if (coin_ctx.bid > 0 && coin_ctx.ask > 0) {
-        LOG_DEBUG(coin_ctx.logger, "[bid={}; ask={}; exchange={}]",
-                  coin_ctx.bid, coin_ctx.ask, coin_ctx.exchange);
+    if (result == FrameResult::kOther) {
+      if (obj.contains("channel") && obj.at("channel") == "pong") {
+        LOG_DEBUG(main_logger, "Received pong msg! {}", coin_ctx.to_str());
+      } else if (!obj.contains("channel") ||
+                 obj.at("channel") != "clientId") {
+        LOG_WARNING(main_logger, "{} unknown msg received: {}",
+                    coin_ctx.to_str(), boost::json::serialize(obj));
       }
+      continue;
+    }
+    if (result != FrameResult::kUpdate) {
+      continue;
+    }
+    if (diff) {
+      ws.on_book_synced();
+    }
 
-      const auto timestamp = obj.at("ts").as_int64();
-      coin_ctx.ask_time = TimePoint(std::chrono::milliseconds(timestamp));
-      coin_ctx.bid_time = coin_ctx.ask_time;
-    } else if (obj.contains("channel") && obj.at("channel") == "pong") {
-      LOG_DEBUG(main_logger, "Received pong msg! {}", coin_ctx.to_str());
-    } else if (!obj.contains("channel") || obj.at("channel") != "clientId") {
-      LOG_WARNING(main_logger, "{} unknown msg received: {}", coin_ctx.to_str(),
-                  boost::json::serialize(obj));
+    if (coin_ctx.bid > 0 && coin_ctx.ask > 0) {
+      LOG_DEBUG(main_logger, "[bid={}; ask={}] {}", coin_ctx.bid, coin_ctx.ask,
+                coin_ctx.to_str());
     }
-    ws.clear_buffer();
+    coin_ctx.notify();
   }
 }
 
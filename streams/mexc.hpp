@@ -1,12 +1,25 @@
 #pragma once
 
+#include <stop_token>
+
 #include <quill/Logger.h>
+#include <boost/json/object.hpp>
 
+#include "book_sync.hpp"
 #include "context.hpp"
 
 namespace stream {
 
+// See RunBinanceStream.
 void RunMexcStream(models::CoinContext& coin_ctx,
-                   quill::Logger* const& main_logger);
+                   quill::Logger* const& main_logger,
+                   std::stop_token stop = {});
+
+// Frame handling of the stream without the connection, see
+// ApplyBinanceFrame.
+FrameResult ApplyMexcFrame(const boost::json::object& obj,
+                           models::CoinContext& coin_ctx, DiffBook* diff);
+bool IsMexcSnapshot(const boost::json::object& obj);
+void LoadMexcSnapshot(const boost::json::object& snapshot, DiffBook& diff);
 
 }  // namespace stream
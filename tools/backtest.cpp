@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+#include <boost/json/parse.hpp>
+
+#include "binance.hpp"
+#include "context.hpp"
+#include "feed.hpp"
+#include "gateio.hpp"
+#include "mexc.hpp"
+#include "scanner.hpp"
+
+namespace {
+
+using stream::FrameResult;
+
+// Quote of one exchange after a recorded update, as the scanner sees it.
+struct Tick {
+  int64_t time_us;        // receive time of the frame
+  uint32_t exchange;      // index in the contexts of the symbol
+  int64_t quote_time_ms;  // exchange time of the quote
+  scanner::Quote quote;
+};
+
+struct Series {
+  std::string symbol;
+  size_t exchanges = 0;
+  std::vector<Tick> ticks;  // ordered by receive time
+  uint64_t frames = 0;
+  uint64_t unresolved = 0;  // diffs without a recorded snapshot
+};
+
+struct Setting {
+  Percent min_profit;
+  int64_t scan_frequency_ms;
+  int64_t max_quote_age_ms;  // 0 - any age
+};
+
+struct Result {
+  uint64_t passes = 0;
+  uint64_t opportunities = 0;  // passes with an opportunity
+  uint64_t episodes = 0;       // runs of such passes
+  std::vector<int64_t> durations_ms;
+  std::vector<double> spreads;  // best spread of every opportunity pass
+
+  void merge(Result&& other) {
+    passes += other.passes;
+    opportunities += other.opportunities;
+    episodes += other.episodes;
+    durations_ms.insert(durations_ms.end(), other.durations_ms.begin(),
+                        other.durations_ms.end());
+    spreads.insert(spreads.end(), other.spreads.begin(), other.spreads.end());
+  }
+};
+
+// Runs task(i) for every i < count, the threads take the next task from a
+// shared counter, so long symbols do not hold up a static share.
+template <typename Task>
+void parallel_for(size_t count, size_t threads, const Task& task) {
+  std::atomic<size_t> next = 0;
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < std::min(threads, count); ++t) {
+    workers.emplace_back([&] {
+      for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) <
+                     count;) {
+        task(i);
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+template <typename T>
+std::vector<T> parse_list(const std::string& list) {
+  std::vector<T> result;
+  std::istringstream stream(list);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    result.push_back(static_cast<T>(std::stold(item)));
+  }
+  return result;
+}
+
+FrameResult apply_frame(const boost::json::object& obj,
+                        models::CoinContext& coin_ctx,
+                        stream::DiffBook* diff) {
+  switch (coin_ctx.exchange) {
+    case Exchange::kBinance:
+      return stream::ApplyBinanceFrame(obj, coin_ctx, diff);
+    case Exchange::kMexc:
+      return stream::ApplyMexcFrame(obj, coin_ctx, diff);
+    case Exchange::kGate:
+      return stream::ApplyGateFrame(obj, coin_ctx, diff);
+  }
+  return FrameResult::kOther;
+}
+
+// False if `obj` is not a REST snapshot of the exchange.
+bool load_snapshot(const boost::json::object& obj,
+                   const models::CoinContext& coin_ctx,
+                   stream::DiffBook& diff) {
+  switch (coin_ctx.exchange) {
+    case Exchange::kBinance:
+      if (!stream::IsBinanceSnapshot(obj)) {
+        return false;
+      }
+      stream::LoadBinanceSnapshot(obj, diff);
+      return true;
+    case Exchange::kMexc:
+      if (!stream::IsMexcSnapshot(obj)) {
+        return false;
+      }
+      stream::LoadMexcSnapshot(obj, diff);
+      return true;
+    case Exchange::kGate:
+      if (!stream::IsGateSnapshot(obj)) {
+        return false;
+      }
+      stream::LoadGateSnapshot(obj, diff);
+      return true;
+  }
+  return false;
+}
+
+// Recorded frame of one exchange of a symbol.
+struct Record {
+  int64_t time_us;
+  uint32_t exchange;  // index in the contexts of the symbol
+  std::string payload;
+};
+
+// Replays the recorded frames and REST snapshots of one symbol through the
+// frame handling of the streams, a segment at a time. The stream retries the
+// diff that asked for a snapshot right after loading it, so does the replay.
+struct Loader {
+  struct Replay {
+    std::string exchange;
+    std::optional<stream::DiffBook> diff;
+    std::optional<boost::json::object> pending;  // diff waiting for snapshot
+  };
+
+  Series series;
+  std::vector<Replay> replays;  // by index in the contexts of the symbol
+  std::vector<Record> records;  // of the current segment, in write order
+
+  Loader(const std::string& symbol,
+         const std::vector<models::CoinContext>& ctx_by_coin)
+      : series{.symbol = symbol,
+               .exchanges = ctx_by_coin.size(),
+               .ticks = {},
+               .frames = 0,
+               .unresolved = 0},
+        replays(ctx_by_coin.size()) {
+    for (size_t i = 0; i < ctx_by_coin.size(); ++i) {
+      const auto& coin_ctx = ctx_by_coin[i];
+      replays[i].exchange = exchange_dir(coin_ctx.exchange);
+      if (coin_ctx.options.diff_depth) {
+        // offsets of BookSync as in the streams
+        replays[i].diff.emplace(coin_ctx.exchange == Exchange::kBinance ? 0
+                                                                        : 1);
+      }
+    }
+  }
+
+  // Index of the exchange in the contexts of the symbol, nullopt - not in
+  // the config.
+  std::optional<uint32_t> find(std::string_view exchange) const {
+    for (size_t i = 0; i < replays.size(); ++i) {
+      if (replays[i].exchange == exchange) {
+        return static_cast<uint32_t>(i);
+      }
+    }
+    return std::nullopt;
+  }
+
+  // Replays and clears the records of the segment.
+  void replay(std::vector<models::CoinContext>& ctx_by_coin) {
+    for (auto& record : records) {
+      apply(record, ctx_by_coin[record.exchange]);
+    }
+    records.clear();
+  }
+
+  // Orders the ticks of the exchanges by receive time.
+  Series finish() {
+    std::stable_sort(series.ticks.begin(), series.ticks.end(),
+                     [](const Tick& lhs, const Tick& rhs) {
+                       return lhs.time_us < rhs.time_us;
+                     });
+    return std::move(series);
+  }
+
+ private:
+  void apply(const Record& record, models::CoinContext& coin_ctx) {
+    boost::json::value value;
+    try {
+      value = boost::json::parse(record.payload);
+    } catch (const std::exception&) {
+      return;
+    }
+    if (!value.is_object()) {
+      return;
+    }
+    ++series.frames;
+
+    auto& replay = replays[record.exchange];
+    auto* diff = replay.diff ? &*replay.diff : nullptr;
+    auto result = FrameResult::kOther;
+    if (diff && load_snapshot(value.as_object(), coin_ctx, *diff)) {
+      if (!replay.pending) {
+        return;
+      }
+      result = apply_frame(*replay.pending, coin_ctx, diff);
+      if (result != FrameResult::kResync) {
+        replay.pending.reset();
+      }
+    } else {
+      result = apply_frame(value.as_object(), coin_ctx, diff);
+      if (result == FrameResult::kResync) {
+        ++series.unresolved;
+        replay.pending = std::move(value.as_object());
+      }
+    }
+    if (result != FrameResult::kUpdate) {
+      return;
+    }
+
+    const auto quote_time = std::min(coin_ctx.bid_time, coin_ctx.ask_time);
+    series.ticks.push_back({
+        .time_us = record.time_us,
+        .exchange = record.exchange,
+        .quote_time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             quote_time.time_since_epoch())
+                             .count(),
+        .quote = {coin_ctx.bid, coin_ctx.ask},
+    });
+  }
+};
+
+// Series of every symbol of the context. Each segment is decompressed once,
+// its records are dispatched to the loaders of their symbols, which replay
+// them on the thread pool before the next segment is read.
+std::vector<Series> load(const feed::FeedReader& reader, models::Context& ctx,
+                         size_t threads) {
+  std::vector<Loader> loaders;
+  loaders.reserve(ctx.coin_to_ctx.size());
+  for (size_t i = 0; i < ctx.coin_to_ctx.size(); ++i) {
+    loaders.emplace_back(ctx.symbols.name(i), ctx.coin_to_ctx[i]);
+  }
+
+  for (size_t segment = 0; segment < reader.segments(); ++segment) {
+    // blocks hold the records of one stream, the lookup is done per block
+    const feed::Block* last_block = nullptr;
+    Loader* loader = nullptr;
+    std::optional<uint32_t> exchange;
+    reader.read_segment(
+        segment, feed::Channel::kIn, "",
+        [&](const feed::Block& block, int64_t time_us,
+            std::string_view payload) {
+          if (&block != last_block) {
+            last_block = &block;
+            const auto symbol_id = ctx.symbols.find(block.symbol);
+            loader = symbol_id ? &loaders[*symbol_id] : nullptr;
+            exchange = loader ? loader->find(block.exchange) : std::nullopt;
+          }
+          if (exchange) {
+            loader->records.push_back(
+                {time_us, *exchange, std::string(payload)});
+          }
+        });
+    parallel_for(loaders.size(), threads, [&](size_t i) {
+      loaders[i].replay(ctx.coin_to_ctx[i]);
+    });
+  }
+
+  std::vector<Series> series;
+  for (auto& loader : loaders) {
+    series.push_back(loader.finish());
+  }
+  return series;
+}
+
+// Scanner passes over one symbol every `scan_frequency_ms` of receive time,
+// with the decision of Scanner::check_profit.
+Result simulate(const Series& series, const Setting& setting) {
+  Result result;
+  if (series.ticks.empty()) {
+    return result;
+  }
+
+  std::vector<scanner::Quote> quotes(series.exchanges, {-1, -1});
+  std::vector<int64_t> quote_times(series.exchanges, 0);
+  const int64_t step_us = std::max<int64_t>(setting.scan_frequency_ms, 1) * 1000;
+  const auto& ticks = series.ticks;
+
+  size_t next = 0;
+  int64_t now_us = ticks.front().time_us;
+  std::optional<int64_t> episode_start_us;
+  while (true) {
+    for (; next < ticks.size() && ticks[next].time_us <= now_us; ++next) {
+      quotes[ticks[next].exchange] = ticks[next].quote;
+      quote_times[ticks[next].exchange] = ticks[next].quote_time_ms;
+    }
+
+    const auto usable = [&](size_t i) {
+      return quotes[i].ask != -1 && quotes[i].bid != -1 &&
+             (!setting.max_quote_age_ms ||
+              now_us / 1000 - quote_times[i] <= setting.max_quote_age_ms);
+    };
+    std::optional<double> best;
+    for (size_t i = 0; i < quotes.size(); ++i) {
+      if (!usable(i)) {
+        continue;
+      }
+      for (size_t j = i + 1; j < quotes.size(); ++j) {
+        if (!usable(j)) {
+          continue;
+        }
+        const auto maker =
+            scanner::find_maker(quotes[i], quotes[j], setting.min_profit);
+        if (maker == scanner::Maker::kNone) {
+          continue;
+        }
+        const auto& [ask, bid] = maker == scanner::Maker::kFirst
+                                     ? std::pair(quotes[i].ask, quotes[j].bid)
+                                     : std::pair(quotes[j].ask, quotes[i].bid);
+        const auto spread = static_cast<double>(scanner::calc_spread(ask, bid));
+        best = std::max(best.value_or(spread), spread);
+      }
+    }
+
+    ++result.passes;
+    if (best) {
+      ++result.opportunities;
+      result.spreads.push_back(*best);
+      if (!episode_start_us) {
+        ++result.episodes;
+        episode_start_us = now_us;
+      }
+    } else if (episode_start_us) {
+      result.durations_ms.push_back((now_us - *episode_start_us) / 1000);
+      episode_start_us.reset();
+    }
+
+    if (next == ticks.size()) {
+      break;
+    }
+    // quotes only get older until the next update, so without an
+    // opportunity the passes in between find nothing
+    if (!best) {
+      const auto idle = (ticks[next].time_us - now_us) / step_us;
+      result.passes += std::max<int64_t>(idle - 1, 0);
+      now_us += std::max<int64_t>(idle, 1) * step_us;
+    } else {
+      now_us += step_us;
+    }
+  }
+  if (episode_start_us) {
+    result.durations_ms.push_back((now_us - *episode_start_us) / 1000);
+  }
+  return result;
+}
+
+template <typename T>
+T percentile(std::vector<T>& values, double p) {
+  if (values.empty()) {
+    return T{};
+  }
+  const auto n = static_cast<size_t>(p * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + n, values.end());
+  return values[n];
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 6 && argc != 7) {
+    std::cerr << "Usage: " << argv[0]
+              << " <config.json> <feed path> <min_profit,...> "
+                 "<scan_frequency_ms,...> <max_quote_age_ms,...> [threads]\n";
+    return EXIT_FAILURE;
+  }
+
+  const auto threads = argc == 7 ? std::stoul(argv[6])
+                                 : std::max(1u, std::thread::hardware_concurrency());
+  if (!threads) {
+    std::cerr << "threads must be positive\n";
+    return EXIT_FAILURE;
+  }
+
+  // the config of the recording: symbols, commissions and depth modes
+  models::Context ctx(argv[1], "logs/backtest.log");
+  const feed::FeedReader reader(argv[2]);
+
+  std::vector<Setting> settings;
+  for (const auto min_profit : parse_list<Percent>(argv[3])) {
+    for (const auto frequency : parse_list<int64_t>(argv[4])) {
+      for (const auto max_age : parse_list<int64_t>(argv[5])) {
+        settings.push_back({min_profit, frequency, max_age});
+      }
+    }
+  }
+
+  const auto started = std::chrono::steady_clock::now();
+  const auto series = load(reader, ctx, threads);
+  const auto loaded = std::chrono::steady_clock::now();
+  for (const auto& s : series) {
+    std::cerr << fmt::format("{}: frames={} updates={} unresolved_diffs={}\n",
+                             s.symbol, s.frames, s.ticks.size(), s.unresolved);
+  }
+
+  // one task per (symbol, setting)
+  std::vector<Result> results(series.size() * settings.size());
+  parallel_for(results.size(), threads, [&](size_t i) {
+    results[i] = simulate(series[i % series.size()],
+                          settings[i / series.size()]);
+  });
+  const auto finished = std::chrono::steady_clock::now();
+  std::cerr << fmt::format(
+      "load={:.2f}s sweep={:.2f}s settings={} threads={}\n",
+      std::chrono::duration<double>(loaded - started).count(),
+      std::chrono::duration<double>(finished - loaded).count(),
+      settings.size(), threads);
+
+  fmt::print(
+      "min_profit,scan_frequency_ms,max_quote_age_ms,passes,opportunities,"
+      "episodes,duration_ms_p50,duration_ms_p90,duration_ms_max,spread_p50,"
+      "spread_p90,spread_p99,spread_max\n");
+  for (size_t s = 0; s < settings.size(); ++s) {
+    Result total;
+    for (size_t i = 0; i < series.size(); ++i) {
+      total.merge(std::move(results[s * series.size() + i]));
+    }
+    const auto& setting = settings[s];
+    fmt::print("{},{},{},{},{},{},{},{},{},{:.6f},{:.6f},{:.6f},{:.6f}\n",
+               static_cast<double>(setting.min_profit),
+               setting.scan_frequency_ms, setting.max_quote_age_ms,
+               total.passes, total.opportunities, total.episodes,
+               percentile(total.durations_ms, 0.5),
+               percentile(total.durations_ms, 0.9),
+               percentile(total.durations_ms, 1.),
+               percentile(total.spreads, 0.5), percentile(total.spreads, 0.9),
+               percentile(total.spreads, 0.99), percentile(total.spreads, 1.));
+  }
+  return EXIT_SUCCESS;
+}
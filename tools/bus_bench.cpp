@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "context.hpp"
+#include "quote_bus.hpp"
+
+// Throughput and publish-to-apply latency of the quote bus over loopback.
+// The publisher and the subscriber of the "bus" section of the config run in
+// one process, every message carries its index in the bid price.
+
+namespace {
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 4) {
+    std::cerr << "Usage: " << argv[0]
+              << " <config.json> <messages> <messages_per_second, 0 - max>\n";
+    return EXIT_FAILURE;
+  }
+  const auto messages = std::stoul(argv[2]);
+  const auto rate = std::stoul(argv[3]);
+  if (!messages) {
+    std::cerr << "messages must be positive\n";
+    return EXIT_FAILURE;
+  }
+
+  models::Context ctx(argv[1], "logs/bus_bench.log");
+  if (ctx.coin_to_ctx.empty()) {
+    std::cerr << "no coins in the config\n";
+    return EXIT_FAILURE;
+  }
+  auto& target = ctx.coin_to_ctx.front().front();
+
+  std::vector<int64_t> sent_ns(messages);
+  std::vector<int64_t> latencies_ns;
+  latencies_ns.reserve(messages);
+  std::atomic<bool> ready = false;
+  std::atomic<uint64_t> received = 0;
+  target.on_update = [&](const models::CoinContext& coin_ctx) {
+    const auto index = static_cast<int64_t>(coin_ctx.bid_pure);
+    if (index < 0) {
+      ready = true;
+      return;
+    }
+    latencies_ns.push_back(now_ns() - sent_ns[index]);
+    received.fetch_add(1, std::memory_order_release);
+  };
+
+  // stopped and joined on return, after the publisher is gone
+  std::jthread subscriber_thread([&ctx](std::stop_token stop) {
+    bus::QuoteSubscriber subscriber(ctx);
+    subscriber.run(stop);
+  });
+  bus::QuotePublisher publisher(ctx);
+
+  // a copy of the target, so the subscriber does not write the published one
+  models::CoinContext quote;
+  quote.symbol = target.symbol;
+  quote.exchange = target.exchange;
+  quote.ask_pure = 1;
+
+  // the scanner side may need a moment to listen or join the group
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (!ready && std::chrono::steady_clock::now() < deadline) {
+    quote.bid_pure = -2;
+    publisher.publish(quote);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  if (!ready) {
+    std::cerr << "no message came through the bus in 5s\n";
+    return EXIT_FAILURE;
+  }
+
+  const auto begin_ns = now_ns();
+  for (size_t i = 0; i < messages; ++i) {
+    if (rate) {
+      const auto due = begin_ns + static_cast<int64_t>(i * 1000000000 / rate);
+      while (now_ns() < due) {
+      }
+    }
+    quote.bid_pure = i;
+    sent_ns[i] = now_ns();
+    publisher.publish(quote);
+  }
+  const auto sent_end_ns = now_ns();
+
+  // lost datagrams never arrive, give the rest a moment
+  auto last = received.load();
+  do {
+    last = received.load();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  } while (received.load() != last);
+  const auto count = received.load(std::memory_order_acquire);
+
+  std::sort(latencies_ns.begin(), latencies_ns.begin() + count);
+  const auto at = [&](double p) {
+    return count ? latencies_ns[static_cast<size_t>(p * (count - 1))] / 1000.
+                 : 0.;
+  };
+  fmt::print(
+      "transport,messages,received,lost,send_rate,p50_us,p90_us,p99_us,"
+      "max_us\n");
+  fmt::print("{},{},{},{},{:.0f},{:.1f},{:.1f},{:.1f},{:.1f}\n",
+             ctx.bus.tcp ? "tcp" : "multicast", messages, count,
+             messages - count,
+             messages * 1e9 / std::max<int64_t>(sent_end_ns - begin_ns, 1),
+             at(0.5), at(0.9), at(0.99), at(1.));
+  return EXIT_SUCCESS;
+}
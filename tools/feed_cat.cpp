@@ -0,0 +1,24 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <fmt/format.h>
+
+#include "feed.hpp"
+
+int main(int argc, char* argv[]) {
+  feed::Channel channel;
+  if ((argc != 3 && argc != 4) || !feed::parse_channel(argv[2], channel)) {
+    std::cerr << "Usage: " << argv[0] << " <path> <in|out|spread> [SYMBOL]\n";
+    return EXIT_FAILURE;
+  }
+
+  const feed::FeedReader reader(argv[1]);
+  reader.read(channel, argc == 4 ? argv[3] : "",
+              [](const feed::Block& block, int64_t time_us,
+                 std::string_view payload) {
+                fmt::print("{},{},{},{}\n", time_us, block.symbol,
+                           block.exchange, payload);
+              });
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "arbitrage.hpp"
+#include "context.hpp"
+
+// Cost of one update of the triangular rate graph at hundreds of assets. The
+// coins of the config are replaced by synthetic ones, every coin is quoted in
+// every quote asset and on every exchange of the config. Prices follow random
+// asset values with a noise below the spread, so cycles are rare and the
+// latency is that of the common search which finds nothing.
+
+namespace {
+
+namespace pt = boost::property_tree;
+
+const auto kConfigPath = "logs/graph_bench.json";
+const double kHalfSpread = 0.0005;
+const double kNoise = 0.0002;
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 4) {
+    std::cerr << "Usage: " << argv[0] << " <config.json> <coins> <updates>\n";
+    return EXIT_FAILURE;
+  }
+  const auto coins = std::stoul(argv[2]);
+  const auto updates = std::stoul(argv[3]);
+  if (!coins || !updates) {
+    std::cerr << "coins and updates must be positive\n";
+    return EXIT_FAILURE;
+  }
+
+  pt::ptree config;
+  pt::read_json(argv[1], config);
+  pt::ptree coin_list;
+  for (size_t i = 0; i < coins; ++i) {
+    pt::ptree item;
+    item.put("", fmt::format("C{}", i));
+    coin_list.push_back({"", item});
+  }
+  config.put_child("coins", coin_list);
+  config.put("triangular.enabled", true);
+  pt::write_json(kConfigPath, config);
+
+  models::Context ctx(kConfigPath, "logs/graph_bench.log");
+  arbitrage::Graph graph(ctx);
+  uint64_t cycles = 0;
+  graph.set_callback([&cycles](const arbitrage::Cycle&) { ++cycles; });
+
+  std::mt19937_64 rng(42);
+  std::lognormal_distribution<double> value_of(0., 2.);
+  std::normal_distribution<double> noise(0., kNoise);
+  std::vector<double> values(ctx.assets.size());
+  for (auto& value : values) {
+    value = value_of(rng);
+  }
+  const auto move = [&](models::CoinContext& coin_ctx) {
+    const auto mid = values[coin_ctx.coin_id] / values[coin_ctx.quote_id] *
+                     std::exp(noise(rng));
+    coin_ctx.bid_pure = mid * (1. - kHalfSpread);
+    coin_ctx.ask_pure = mid * (1. + kHalfSpread);
+  };
+
+  std::vector<models::CoinContext*> markets;
+  for (auto& ctx_by_coin : ctx.coin_to_ctx) {
+    for (auto& coin_ctx : ctx_by_coin) {
+      markets.push_back(&coin_ctx);
+      move(coin_ctx);
+      graph.update(coin_ctx);
+    }
+  }
+  cycles = 0;
+
+  std::uniform_int_distribution<size_t> market_of(0, markets.size() - 1);
+  std::vector<int64_t> latencies_ns;
+  latencies_ns.reserve(updates);
+  const auto begin_ns = now_ns();
+  for (size_t i = 0; i < updates; ++i) {
+    auto& coin_ctx = *markets[market_of(rng)];
+    move(coin_ctx);
+    const auto start_ns = now_ns();
+    graph.update(coin_ctx);
+    latencies_ns.push_back(now_ns() - start_ns);
+  }
+  const auto total_ns = now_ns() - begin_ns;
+
+  std::sort(latencies_ns.begin(), latencies_ns.end());
+  const auto at = [&](double p) {
+    return latencies_ns[static_cast<size_t>(p * (latencies_ns.size() - 1))] /
+           1000.;
+  };
+  fmt::print(
+      "assets,markets,max_length,updates,cycles,updates_per_s,p50_us,p90_us,"
+      "p99_us,max_us\n");
+  fmt::print("{},{},{},{},{},{:.0f},{:.1f},{:.1f},{:.1f},{:.1f}\n",
+             ctx.assets.size(), markets.size(), ctx.triangular.max_length,
+             updates, cycles, updates * 1e9 / std::max<int64_t>(total_ns, 1),
+             at(0.5), at(0.9), at(0.99), at(1.));
+  return EXIT_SUCCESS;
+}
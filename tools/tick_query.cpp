@@ -0,0 +1,63 @@
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+#include <iostream>
+#include <string>
+
+#include <fmt/format.h>
+
+#include "tick_store.hpp"
+
+namespace {
+
+int query(char* argv[], bool resample) {
+  const ticks::TickReader reader(argv[1], argv[2], argv[3]);
+  const auto from_ms = std::stoll(argv[4]);
+  const auto to_ms = std::stoll(argv[5]);
+
+  if (!resample) {
+    fmt::print("time_ms,bid,ask\n");
+    for (const auto& slice : reader.range(from_ms, to_ms)) {
+      for (size_t i = 0; i < slice.time.size(); ++i) {
+        fmt::print("{},{},{}\n", slice.time[i], slice.bid[i], slice.ask[i]);
+      }
+    }
+    return EXIT_SUCCESS;
+  }
+
+  const auto resolution_ms = std::stoll(argv[6]);
+  if (resolution_ms <= 0) {
+    std::cerr << "resolution_ms must be positive\n";
+    return EXIT_FAILURE;
+  }
+  fmt::print("time_ms,open,high,low,close,bid,ask,count\n");
+  for (const auto& bar : reader.resample(from_ms, to_ms, resolution_ms)) {
+    fmt::print("{},{},{},{},{},{},{},{}\n", bar.time_ms, bar.open, bar.high,
+               bar.low, bar.close, bar.bid, bar.ask, bar.count);
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 6 && argc != 7) {
+    std::cerr << "Usage: " << argv[0]
+              << " <path> <SYMBOL> <exchange> <from_ms> <to_ms> "
+                 "[resolution_ms]\n";
+    return EXIT_FAILURE;
+  }
+  try {
+    return query(argv, argc == 7);
+  } catch (const std::filesystem::filesystem_error& e) {
+    // no such symbol or exchange in the store
+    std::cerr << e.what() << "\n";
+  } catch (const std::runtime_error& e) {
+    // a damaged segment
+    std::cerr << e.what() << "\n";
+  } catch (const std::logic_error& e) {
+    // a bad number
+    std::cerr << "bad argument: " << e.what() << "\n";
+  }
+  return EXIT_FAILURE;
+}
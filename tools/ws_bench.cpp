@@ -0,0 +1,193 @@
+#include <sys/resource.h>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fmt/format.h>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/beast/websocket/ssl.hpp>
+
+#include "base_stream.hpp"
+#include "context.hpp"
+#include "logger.hpp"
+
+// Receive-to-parse latency and cpu of the receive loop of the streams: a
+// WebsocketBaseStream reads from a local TLS websocket stand-in of Binance
+// with the transport options of the mode, as a stream of the engine would.
+
+namespace {
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+using tcp = asio::ip::tcp;
+
+const std::string kSnapshotKey = R"("e":"depthUpdate")";
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t thread_cpu_us() {
+  rusage usage;
+  ::getrusage(RUSAGE_THREAD, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// The streams do not verify the peer, a throwaway certificate will do.
+void use_self_signed(asio::ssl::context& ssl_ctx) {
+  std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(EVP_EC_gen("P-256"),
+                                                          EVP_PKEY_free);
+  std::unique_ptr<X509, decltype(&X509_free)> cert(X509_new(), X509_free);
+  if (!key || !cert) {
+    throw std::runtime_error("failed to create the server certificate");
+  }
+  X509_set_version(cert.get(), 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert.get()), 0);
+  X509_gmtime_adj(X509_getm_notAfter(cert.get()), 24 * 3600);
+  X509_set_pubkey(cert.get(), key.get());
+  auto* name = X509_get_subject_name(cert.get());
+  X509_NAME_add_entry_by_txt(
+      name, "CN", MBSTRING_ASC,
+      reinterpret_cast<const unsigned char*>("127.0.0.1"), -1, -1, 0);
+  X509_set_issuer_name(cert.get(), name);
+  if (!X509_sign(cert.get(), key.get(), EVP_sha256()) ||
+      SSL_CTX_use_certificate(ssl_ctx.native_handle(), cert.get()) != 1 ||
+      SSL_CTX_use_PrivateKey(ssl_ctx.native_handle(), key.get()) != 1) {
+    throw std::runtime_error("failed to set the server certificate");
+  }
+}
+
+// depth20 frame of Binance size, "T" is the send time
+std::string make_frame(int64_t send_ns) {
+  std::string frame = fmt::format(
+      R"({{"e":"depthUpdate","E":1700000000000,"T":{},"s":"SOLUSDT","b":[)",
+      send_ns);
+  for (int i = 0; i < 20; ++i) {
+    frame += fmt::format(R"({}["{:.3f}","{}.000"])", i ? "," : "",
+                         100. - i * 0.01, 10 + i);
+  }
+  frame += R"(],"a":[)";
+  for (int i = 0; i < 20; ++i) {
+    frame += fmt::format(R"({}["{:.3f}","{}.000"])", i ? "," : "",
+                         100.01 + i * 0.01, 10 + i);
+  }
+  return frame + "]}";
+}
+
+void serve(tcp::acceptor& acceptor, asio::ssl::context& ssl_ctx,
+           size_t frames, size_t rate) {
+  beast::websocket::stream<beast::ssl_stream<tcp::socket>> ws(
+      acceptor.accept(), ssl_ctx);
+  get_lowest_layer(ws).set_option(tcp::no_delay(true));
+  ws.next_layer().handshake(asio::ssl::stream_base::server);
+  ws.accept();
+  ws.text(true);
+  const auto period = std::chrono::nanoseconds(1000000000 / rate);
+  auto next = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < frames; ++i) {
+    std::this_thread::sleep_until(next);
+    next += period;
+    ws.write(asio::buffer(make_frame(now_ns())));
+  }
+  beast::error_code ec;
+  ws.close(beast::websocket::close_code::normal, ec);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 4) {
+    std::cerr << "Usage: " << argv[0]
+              << " <sync|busy_poll|conflate> <frames> <frames_per_second>\n";
+    return EXIT_FAILURE;
+  }
+  const std::string mode = argv[1];
+  models::ExchangeOptions options;
+  if (mode == "busy_poll") {
+    options.busy_poll = true;
+  } else if (mode == "conflate") {
+    options.conflate = true;
+  } else if (mode != "sync") {
+    std::cerr << "unknown mode: " << mode << "\n";
+    return EXIT_FAILURE;
+  }
+  const auto frames = std::stoul(argv[2]);
+  const auto rate = std::stoul(argv[3]);
+  if (!frames || !rate) {
+    std::cerr << "frames and frames_per_second must be positive\n";
+    return EXIT_FAILURE;
+  }
+
+  asio::io_context server_ctx;
+  asio::ssl::context server_ssl_ctx(asio::ssl::context::tlsv12_server);
+  use_self_signed(server_ssl_ctx);
+  tcp::acceptor acceptor(server_ctx, {asio::ip::make_address("127.0.0.1"), 0});
+  std::thread server(serve, std::ref(acceptor), std::ref(server_ssl_ctx),
+                     frames, rate);
+
+  auto* logger = logger::init_root_logger("logs/ws_bench.log");
+  models::CoinContext coin_ctx;
+  coin_ctx.domain = "127.0.0.1";
+  coin_ctx.port = std::to_string(acceptor.local_endpoint().port());
+  coin_ctx.target = "/";
+  coin_ctx.symbol = "SOL_USDT";
+  coin_ctx.exchange = Exchange::kBinance;
+  coin_ctx.options = options;
+
+  std::vector<int64_t> latencies_ns;
+  latencies_ns.reserve(frames);
+  int64_t wall_us = 0;
+  int64_t cpu_us = 0;
+  {
+    stream::WebsocketBaseStream ws(coin_ctx, logger);
+    ws.connect_domain();
+    ws.ssl_handshake();
+    ws.websocket_handshake();
+
+    const auto cpu_begin = thread_cpu_us();
+    const auto wall_begin = now_ns();
+    try {
+      while (coin_ctx.frames < frames) {
+        const auto obj = ws.read_newest(kSnapshotKey);
+        latencies_ns.push_back(now_ns() - obj.at("T").as_int64());
+        ws.clear_buffer();
+      }
+    } catch (const beast::system_error& e) {
+      // conflation reads ahead into the close frame after the last one
+      if (e.code() != beast::websocket::error::closed) {
+        throw;
+      }
+    }
+    wall_us = (now_ns() - wall_begin) / 1000;
+    cpu_us = thread_cpu_us() - cpu_begin;
+  }  // the close handshake with the server
+  server.join();
+
+  std::sort(latencies_ns.begin(), latencies_ns.end());
+  const auto at = [&](double p) {
+    return latencies_ns[static_cast<size_t>(p * (latencies_ns.size() - 1))] /
+           1000.;
+  };
+  fmt::print(
+      "mode,frames,rate,parsed,p50_us,p90_us,p99_us,max_us,cpu_pct\n");
+  fmt::print("{},{},{},{},{:.1f},{:.1f},{:.1f},{:.1f},{:.1f}\n", mode, frames,
+             rate, latencies_ns.size(), at(0.5), at(0.9), at(0.99), at(1.),
+             100. * cpu_us / std::max<int64_t>(wall_us, 1));
+  return EXIT_SUCCESS;
+}
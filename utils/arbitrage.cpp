@@ -0,0 +1,194 @@
+#include "arbitrage.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <quill/detail/LogMacros.h>
+
+#include "logger.hpp"
+
+namespace arbitrage {
+
+namespace {
+
+constexpr double kInf = std::numeric_limits<double>::infinity();
+constexpr uint32_t kNoEdge = std::numeric_limits<uint32_t>::max();
+
+}  // namespace
+
+Graph::Graph(models::Context& ctx) : ctx_(ctx) {
+  static const std::string kFormatPatternLog = "%(ascii_time),%(message)";
+
+  logger_ = logger::make_logger("spread/triangular.csv", kFormatPatternLog);
+  logger_->set_log_level(ctx_.main_logger->log_level());
+
+  out_.resize(ctx_.assets.size() * kExchanges);
+  market_edges_.assign(ctx_.market_count(), {kNoEdge, kNoEdge});
+  for (const auto& ctx_by_coin : ctx_.coin_to_ctx) {
+    for (const auto& coin_ctx : ctx_by_coin) {
+      const auto base = node(coin_ctx.exchange, coin_ctx.coin_id);
+      const auto quote = node(coin_ctx.exchange, coin_ctx.quote_id);
+      const auto sell = add_edge(base, quote, &coin_ctx);
+      const auto buy = add_edge(quote, base, &coin_ctx);
+      market_edges_[coin_ctx.market_id()] = {sell, buy};
+    }
+  }
+
+  if (ctx_.triangular.cross_venue) {
+    const auto markets = out_;
+    for (AssetId asset = 0; asset < ctx_.assets.size(); ++asset) {
+      for (uint32_t from = 0; from < kExchanges; ++from) {
+        for (uint32_t to = 0; to < kExchanges; ++to) {
+          const auto from_node = asset * kExchanges + from;
+          const auto to_node = asset * kExchanges + to;
+          if (from != to && !markets[from_node].empty() &&
+              !markets[to_node].empty()) {
+            set_rate(add_edge(from_node, to_node, nullptr), 1.);
+          }
+        }
+      }
+    }
+  }
+
+  const auto max_length = std::max<size_t>(ctx_.triangular.max_length, 2);
+  dist_.assign(max_length, std::vector<double>(out_.size(), kInf));
+  via_.assign(max_length, std::vector<uint32_t>(out_.size()));
+
+  LOG_INFO(ctx_.main_logger,
+           "Rate graph created. [assets={}; nodes={}; edges={}; "
+           "max_length={}]",
+           ctx_.assets.size(), out_.size(), edges_.size(), max_length);
+}
+
+void Graph::set_callback(CycleCallback callback) {
+  callback_ = std::move(callback);
+}
+
+uint32_t Graph::node(Exchange exchange, AssetId asset) {
+  return asset * kExchanges + static_cast<uint32_t>(exchange);
+}
+
+uint32_t Graph::add_edge(uint32_t from, uint32_t to,
+                         const models::CoinContext* coin_ctx) {
+  edges_.push_back({.from = from, .to = to, .coin_ctx = coin_ctx});
+  out_[from].push_back(edges_.size() - 1);
+  return edges_.size() - 1;
+}
+
+void Graph::set_rate(uint32_t edge_id, double rate) {
+  auto& edge = edges_[edge_id];
+  edge.rate = rate;
+  edge.weight = rate > 0 ? -std::log(rate) : kInf;
+}
+
+void Graph::update(const models::CoinContext& coin_ctx) {
+  const auto [sell, buy] = market_edges_[coin_ctx.market_id()];
+  if (sell == kNoEdge) {
+    return;
+  }
+  const double fee = 1. - static_cast<double>(coin_ctx.comm_taker) * 0.01;
+  const auto bid = static_cast<double>(coin_ctx.bid_pure);
+  const auto ask = static_cast<double>(coin_ctx.ask_pure);
+
+  std::lock_guard lock(mutex_);
+  set_rate(sell, bid > 0 ? bid * fee : 0);
+  set_rate(buy, ask > 0 ? fee / ask : 0);
+  search(sell);
+  search(buy);
+}
+
+void Graph::search(uint32_t edge_id) {
+  const auto& edge = edges_[edge_id];
+  if (edge.weight == kInf) {
+    return;
+  }
+  const double threshold = -std::log1p(
+      static_cast<double>(ctx_.triangular.min_profit) * 0.01);
+
+  // Layer k holds the cheapest walks of k edges from `edge.to`, the updated
+  // edge itself closes the cycle at `edge.from`.
+  size_t found_layer = 0;
+  double best = threshold;
+  dist_[0][edge.to] = edge.weight;
+  seen_.push_back(edge.to);
+  frontier_.assign(1, edge.to);
+  for (size_t k = 1; k < dist_.size() && !frontier_.empty(); ++k) {
+    next_frontier_.clear();
+    for (const auto u : frontier_) {
+      if (u == edge.from) {
+        continue;
+      }
+      for (const auto e : out_[u]) {
+        const auto& next = edges_[e];
+        const auto dist = dist_[k - 1][u] + next.weight;
+        if (dist < dist_[k][next.to]) {
+          if (dist_[k][next.to] == kInf) {
+            next_frontier_.push_back(next.to);
+            seen_.push_back(k * out_.size() + next.to);
+          }
+          dist_[k][next.to] = dist;
+          via_[k][next.to] = e;
+        }
+      }
+    }
+    if (dist_[k][edge.from] < best) {
+      best = dist_[k][edge.from];
+      found_layer = k;
+    }
+    std::swap(frontier_, next_frontier_);
+  }
+
+  Cycle cycle;
+  if (found_layer) {
+    cycle.edges.resize(found_layer + 1);
+    cycle.edges[0] = edge_id;
+    auto node = edge.from;
+    for (size_t k = found_layer; k > 0; --k) {
+      cycle.edges[k] = via_[k][node];
+      node = edges_[cycle.edges[k]].from;
+    }
+    cycle.profit = 100 * std::expm1(-best);
+  }
+
+  for (const auto id : seen_) {
+    dist_[id / out_.size()][id % out_.size()] = kInf;
+  }
+  seen_.clear();
+
+  if (!found_layer) {
+    return;
+  }
+  // a walk that visits a node twice contains a shorter cycle, it is reported
+  // by the update of one of its own edges
+  std::vector<uint32_t> nodes;
+  nodes.reserve(cycle.edges.size());
+  for (const auto e : cycle.edges) {
+    nodes.push_back(edges_[e].from);
+  }
+  std::sort(nodes.begin(), nodes.end());
+  if (std::adjacent_find(nodes.begin(), nodes.end()) != nodes.end()) {
+    return;
+  }
+
+  if (callback_) {
+    callback_(cycle);
+  }
+  LOG_INFO(logger_, "{:.6f},{}", cycle.profit, to_str(cycle));
+}
+
+std::string Graph::node_name(uint32_t node) const {
+  return fmt::format("{}:{}", Exchange(node % kExchanges),
+                     ctx_.assets.name(node / kExchanges));
+}
+
+std::string Graph::to_str(const Cycle& cycle) const {
+  std::string result = node_name(edges_[cycle.edges.front()].from);
+  for (const auto e : cycle.edges) {
+    const auto& edge = edges_[e];
+    result += fmt::format(" -> {} ({:.8f})", node_name(edge.to), edge.rate);
+  }
+  return result;
+}
+
+}  // namespace arbitrage
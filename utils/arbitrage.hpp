@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <quill/Logger.h>
+#include <boost/noncopyable.hpp>
+
+#include "context.hpp"
+
+namespace arbitrage {
+
+// Trade or transfer between two (exchange, asset) nodes.
+struct Edge {
+  uint32_t from;
+  uint32_t to;
+  double rate = 0;  // amount of `to` for one `from`, after commission
+  double weight = std::numeric_limits<double>::infinity();  // -log(rate)
+  const models::CoinContext* coin_ctx = nullptr;  // nullptr for a transfer
+};
+
+struct Cycle {
+  std::vector<uint32_t> edges;
+  Percent profit;
+};
+
+using CycleCallback = std::function<void(const Cycle&)>;
+
+// Venue-by-asset rate graph updated on every quote. After an update only the
+// cycles through the changed edges are searched: a bounded Bellman-Ford from
+// the head of the edge back to its tail, so the cost does not depend on the
+// number of untouched markets.
+class Graph : private boost::noncopyable {
+ private:
+  std::vector<Edge> edges_;
+  // node (AssetId * kExchanges + exchange) -> edge ids
+  std::vector<std::vector<uint32_t>> out_;
+  // market id -> (sell base edge, buy base edge), kNoEdge - not a market
+  std::vector<std::pair<uint32_t, uint32_t>> market_edges_;
+
+  // scratch of the search, layer by layer
+  std::vector<std::vector<double>> dist_;
+  std::vector<std::vector<uint32_t>> via_;  // edge into the node on the layer
+  std::vector<uint32_t> frontier_;
+  std::vector<uint32_t> next_frontier_;
+  std::vector<uint32_t> seen_;
+
+  std::mutex mutex_;
+  CycleCallback callback_;
+  quill::Logger* logger_;
+  models::Context& ctx_;
+
+ public:
+  explicit Graph(models::Context& ctx);
+
+  // Called on the thread that updated the quote.
+  void set_callback(CycleCallback callback);
+  void update(const models::CoinContext& coin_ctx);
+
+  std::string to_str(const Cycle& cycle) const;
+
+ private:
+  static uint32_t node(Exchange exchange, AssetId asset);
+  uint32_t add_edge(uint32_t from, uint32_t to,
+                    const models::CoinContext* coin_ctx);
+  void set_rate(uint32_t edge_id, double rate);
+  void search(uint32_t edge_id);
+  std::string node_name(uint32_t node) const;
+};
+
+}  // namespace arbitrage
@@ -0,0 +1,370 @@
+#include "checkpoint.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <system_error>
+
+#include <quill/detail/LogMacros.h>
+
+namespace checkpoint {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x31504b43;  // "CKP1"
+constexpr uint32_t kVersion = 2;
+
+int64_t to_ms(const TimePoint& time_point) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             time_point.time_since_epoch())
+      .count();
+}
+
+TimePoint from_ms(int64_t ms) { return TimePoint(std::chrono::milliseconds(ms)); }
+
+size_t slot_size(uint32_t max_quotes, uint32_t max_coins) {
+  return sizeof(SlotHeader) + max_quotes * sizeof(QuoteRecord) +
+         max_coins * sizeof(StatsRecord);
+}
+
+size_t file_size(uint32_t max_quotes, uint32_t max_coins) {
+  return sizeof(Header) + 2 * slot_size(max_quotes, max_coins);
+}
+
+SlotHeader* slot_of(Header* file, size_t index) {
+  auto* slots = reinterpret_cast<uint8_t*>(file + 1);
+  return reinterpret_cast<SlotHeader*>(
+      slots + index * slot_size(file->max_quotes, file->max_coins));
+}
+
+QuoteRecord* quotes_of(SlotHeader* slot) {
+  return reinterpret_cast<QuoteRecord*>(slot + 1);
+}
+
+StatsRecord* stats_of(const Header* file, SlotHeader* slot) {
+  return reinterpret_cast<StatsRecord*>(quotes_of(slot) + file->max_quotes);
+}
+
+// FNV-1a
+uint64_t checksum(uint64_t hash, const void* data, size_t size) {
+  const auto* begin = static_cast<const uint8_t*>(data);
+  for (const auto* it = begin; it != begin + size; ++it) {
+    hash = (hash ^ *it) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// Does not depend on the capacities, so a slot is copied to a larger file as
+// is.
+uint64_t checksum(const Header* file, SlotHeader* slot) {
+  auto hash = checksum(14695981039346656037ull, slot,
+                       offsetof(SlotHeader, checksum));
+  hash = checksum(hash, quotes_of(slot),
+                  slot->quote_count * sizeof(QuoteRecord));
+  return checksum(hash, stats_of(file, slot),
+                  slot->stats_count * sizeof(StatsRecord));
+}
+
+bool is_valid(const Header* file, SlotHeader* slot) {
+  return slot->generation != 0 && slot->quote_count <= file->max_quotes &&
+         slot->stats_count <= file->max_coins &&
+         slot->checksum == checksum(file, slot);
+}
+
+void copy_coin(char (&dst)[kMaxCoinSize], const std::string& coin) {
+  std::memset(dst, 0, kMaxCoinSize);
+  std::memcpy(dst, coin.data(), std::min(coin.size(), kMaxCoinSize));
+}
+
+std::string coin_of(const char (&src)[kMaxCoinSize]) {
+  return std::string(src, strnlen(src, kMaxCoinSize));
+}
+
+void throw_errno(const std::string& what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+Header* map_file(int fd, size_t size, const std::string& path) {
+  void* addr =
+      ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    throw_errno("mmap " + path);
+  }
+  return static_cast<Header*>(addr);
+}
+
+}  // namespace
+
+Checkpointer::Checkpointer(models::Context& ctx)
+    : max_quotes_(static_cast<uint32_t>(ctx.market_count())),
+      max_coins_(static_cast<uint32_t>(ctx.symbols.size())),
+      ctx_(ctx) {
+  fd_ = ::open(ctx_.checkpoint_path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd_ < 0) {
+    throw_errno("open " + ctx_.checkpoint_path);
+  }
+
+  struct stat st;
+  if (::fstat(fd_, &st) < 0) {
+    throw_errno("fstat " + ctx_.checkpoint_path);
+  }
+  if (static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+    size_ = st.st_size;
+    file_ = map_file(fd_, size_, ctx_.checkpoint_path);
+  }
+
+  if (!file_ || file_->magic != kMagic || file_->version != kVersion ||
+      size_ != file_size(file_->max_quotes, file_->max_coins)) {
+    LOG_WARNING(ctx_.main_logger, "Checkpoint {} is empty or outdated, reset",
+                ctx_.checkpoint_path);
+    reset();
+  } else if (file_->max_quotes < max_quotes_ || file_->max_coins < max_coins_) {
+    grow();
+  }
+
+  staging_ = std::make_unique<Snapshot>();
+  pending_ = std::make_unique<Snapshot>();
+  writing_ = std::make_unique<Snapshot>();
+  for (auto* snapshot : {staging_.get(), pending_.get(), writing_.get()}) {
+    snapshot->quotes.reserve(max_quotes_);
+    snapshot->stats.reserve(max_coins_);
+  }
+  thread_ = std::thread(&Checkpointer::run, this);
+}
+
+Checkpointer::~Checkpointer() {
+  if (thread_.joinable()) {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();  // the pending snapshot is written first
+  }
+  if (file_) {
+    ::munmap(file_, size_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void Checkpointer::reset() {
+  if (file_) {
+    ::munmap(file_, size_);
+    file_ = nullptr;
+  }
+  // truncated to zero first, so nothing of the old file is left
+  size_ = file_size(max_quotes_, max_coins_);
+  if (::ftruncate(fd_, 0) < 0 || ::ftruncate(fd_, size_) < 0) {
+    throw_errno("ftruncate " + ctx_.checkpoint_path);
+  }
+  file_ = map_file(fd_, size_, ctx_.checkpoint_path);
+  *file_ = Header{kMagic, kVersion, max_quotes_, max_coins_};
+}
+
+// The larger file is written aside and renamed over the old one, so a crash
+// in between keeps either of them whole.
+void Checkpointer::grow() {
+  const auto path = ctx_.checkpoint_path + ".tmp";
+  const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw_errno("open " + path);
+  }
+  const auto size = file_size(max_quotes_, max_coins_);
+  if (::ftruncate(fd, size) < 0) {
+    ::close(fd);
+    throw_errno("ftruncate " + path);
+  }
+  auto* file = map_file(fd, size, path);
+  *file = Header{kMagic, kVersion, max_quotes_, max_coins_};
+  for (size_t i = 0; i < 2; ++i) {
+    auto* from = slot_of(file_, i);
+    if (!is_valid(file_, from)) {
+      continue;
+    }
+    auto* to = slot_of(file, i);
+    *to = *from;
+    std::memcpy(quotes_of(to), quotes_of(from),
+                from->quote_count * sizeof(QuoteRecord));
+    std::memcpy(stats_of(file, to), stats_of(file_, from),
+                from->stats_count * sizeof(StatsRecord));
+  }
+  if (::msync(file, size, MS_SYNC) < 0 ||
+      ::rename(path.c_str(), ctx_.checkpoint_path.c_str()) < 0) {
+    const int error = errno;
+    ::munmap(file, size);
+    ::close(fd);
+    errno = error;
+    throw_errno("grow " + ctx_.checkpoint_path);
+  }
+
+  LOG_INFO(ctx_.main_logger,
+           "Checkpoint {} grown. [quotes={}->{}; coins={}->{}]",
+           ctx_.checkpoint_path, file_->max_quotes, max_quotes_,
+           file_->max_coins, max_coins_);
+  ::munmap(file_, size_);
+  ::close(fd_);
+  fd_ = fd;
+  file_ = file;
+  size_ = size;
+}
+
+bool Checkpointer::load(Stats& stats) {
+  SlotHeader* slot = nullptr;
+  for (size_t i = 0; i < 2; ++i) {
+    auto* candidate = slot_of(file_, i);
+    if (is_valid(file_, candidate) &&
+        (!slot || candidate->generation > slot->generation)) {
+      slot = candidate;
+    }
+  }
+  if (!slot) {
+    LOG_INFO(ctx_.main_logger, "No checkpoint to restore in {}",
+             ctx_.checkpoint_path);
+    return false;
+  }
+  generation_ = slot->generation;
+
+  size_t quotes = 0;
+  const auto* quote_records = quotes_of(slot);
+  for (uint32_t i = 0; i < slot->quote_count; ++i) {
+    const auto& record = quote_records[i];
+    // records are keyed by name, ids depend on the config
+    const auto symbol_id = ctx_.symbols.find(coin_of(record.coin));
+    if (!symbol_id) {
+      continue;
+    }
+    for (auto& coin_ctx : ctx_.coin_to_ctx[*symbol_id]) {
+      if (static_cast<uint8_t>(coin_ctx.exchange) != record.exchange ||
+          coin_ctx.updates != 0) {
+        continue;
+      }
+      coin_ctx.set_top(record.bid_pure, record.ask_pure);
+      coin_ctx.bid_time = from_ms(record.bid_time_ms);
+      coin_ctx.ask_time = from_ms(record.ask_time_ms);
+      coin_ctx.updates = record.updates;
+      coin_ctx.stale = true;
+      ++quotes;
+    }
+  }
+
+  size_t coins = 0;
+  const auto* stats_records = stats_of(file_, slot);
+  for (uint32_t i = 0; i < slot->stats_count; ++i) {
+    const auto& record = stats_records[i];
+    const auto symbol_id = ctx_.symbols.find(coin_of(record.coin));
+    if (!symbol_id || *symbol_id >= stats.size()) {
+      continue;
+    }
+    auto& coin_stats = stats[*symbol_id];
+    coin_stats.opportunities = record.opportunities;
+    coin_stats.episodes = record.episodes;
+    coin_stats.max_spread = record.max_spread;
+    coin_stats.last_opportunity = from_ms(record.last_opportunity_ms);
+    coin_stats.in_episode = record.in_episode;
+    ++coins;
+  }
+
+  LOG_INFO(ctx_.main_logger,
+           "Checkpoint restored. [generation={}; age={}ms; quotes={}; "
+           "coins={}]",
+           slot->generation,
+           to_ms(std::chrono::system_clock::now()) - slot->saved_at_ms, quotes,
+           coins);
+  return true;
+}
+
+void Checkpointer::save(const Stats& stats) {
+  auto& snapshot = *staging_;
+
+  snapshot.quotes.clear();
+  for (const auto& ctx_by_coin : ctx_.coin_to_ctx) {
+    for (const auto& coin_ctx : ctx_by_coin) {
+      if (coin_ctx.updates == 0) {
+        continue;
+      }
+      auto& record = snapshot.quotes.emplace_back();
+      copy_coin(record.coin, coin_ctx.symbol);
+      record.exchange = static_cast<uint8_t>(coin_ctx.exchange);
+      record.updates = coin_ctx.updates;
+      record.bid_pure = static_cast<double>(coin_ctx.bid_pure);
+      record.ask_pure = static_cast<double>(coin_ctx.ask_pure);
+      record.bid_time_ms = to_ms(coin_ctx.bid_time);
+      record.ask_time_ms = to_ms(coin_ctx.ask_time);
+    }
+  }
+
+  snapshot.stats.clear();
+  const auto coins = std::min<size_t>(stats.size(), max_coins_);
+  for (SymbolId symbol_id = 0; symbol_id < coins; ++symbol_id) {
+    const auto& coin_stats = stats[symbol_id];
+    auto& record = snapshot.stats.emplace_back();
+    copy_coin(record.coin, ctx_.symbols.name(symbol_id));
+    record.opportunities = coin_stats.opportunities;
+    record.episodes = coin_stats.episodes;
+    record.max_spread = static_cast<double>(coin_stats.max_spread);
+    record.last_opportunity_ms = to_ms(coin_stats.last_opportunity);
+    record.in_episode = coin_stats.in_episode;
+  }
+
+  snapshot.saved_at_ms = to_ms(std::chrono::system_clock::now());
+
+  {
+    std::lock_guard lock(mutex_);
+    std::swap(staging_, pending_);
+    has_pending_ = true;
+  }
+  cv_.notify_one();
+}
+
+void Checkpointer::run() {
+  while (true) {
+    {
+      std::unique_lock lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || has_pending_; });
+      if (!has_pending_) {
+        return;
+      }
+      std::swap(pending_, writing_);
+      has_pending_ = false;
+    }
+    write(*writing_);
+  }
+}
+
+void Checkpointer::write(const Snapshot& snapshot) {
+  const auto generation = generation_ + 1;
+  auto* slot = slot_of(file_, generation % 2);
+  slot->generation = 0;  // invalid until the checksum is written
+
+  // the file holds every market and symbol of the config
+  std::memcpy(quotes_of(slot), snapshot.quotes.data(),
+              snapshot.quotes.size() * sizeof(QuoteRecord));
+  std::memcpy(stats_of(file_, slot), snapshot.stats.data(),
+              snapshot.stats.size() * sizeof(StatsRecord));
+  slot->saved_at_ms = snapshot.saved_at_ms;
+  slot->quote_count = static_cast<uint32_t>(snapshot.quotes.size());
+  slot->stats_count = static_cast<uint32_t>(snapshot.stats.size());
+  slot->generation = generation;
+  slot->checksum = checksum(file_, slot);
+
+  // flush only the pages of this slot, the other one stays untouched
+  static const auto kPageSize = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+  const auto begin = reinterpret_cast<uintptr_t>(slot) & ~(kPageSize - 1);
+  const auto end = reinterpret_cast<uintptr_t>(slot) +
+                   slot_size(file_->max_quotes, file_->max_coins);
+  if (::msync(reinterpret_cast<void*>(begin), end - begin, MS_SYNC) < 0) {
+    LOG_WARNING(ctx_.main_logger, "Checkpoint msync failed: {}",
+                std::strerror(errno));
+    return;
+  }
+  generation_ = generation;
+}
+
+}  // namespace checkpoint
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "context.hpp"
+
+namespace checkpoint {
+
+inline constexpr size_t kMaxCoinSize = kMaxSymbolSize;
+
+struct QuoteRecord {
+  char coin[kMaxCoinSize];
+  uint8_t exchange;
+  uint64_t updates;  // local count of quote updates, not an exchange sequence
+  double bid_pure;
+  double ask_pure;
+  int64_t bid_time_ms;
+  int64_t ask_time_ms;
+};
+
+struct StatsRecord {
+  char coin[kMaxCoinSize];
+  uint64_t opportunities;
+  uint64_t episodes;
+  double max_spread;
+  int64_t last_opportunity_ms;
+  uint8_t in_episode;
+};
+
+// Start of the file. The capacities size both slots, they are taken from the
+// config: every market and every symbol of it has a record.
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t max_quotes;
+  uint32_t max_coins;
+};
+
+// One consistent snapshot, followed by QuoteRecord[max_quotes] and
+// StatsRecord[max_coins]. Two slots are written in turn, so a crash in the
+// middle of a save never damages the previous snapshot.
+struct SlotHeader {
+  uint64_t generation;  // 0 - never written
+  uint64_t saved_at_ms;
+  uint32_t quote_count;
+  uint32_t stats_count;
+  uint64_t checksum;  // of the fields above and the records in use
+};
+
+// Records of a save, in memory.
+struct Snapshot {
+  uint64_t saved_at_ms = 0;
+  std::vector<QuoteRecord> quotes;
+  std::vector<StatsRecord> stats;
+};
+
+using Stats = std::vector<models::ScanStats>;  // by SymbolId
+
+// Warm-restart state of quotes and scanner aggregates in a memory-mapped file.
+// The caller only copies the records, the checksum and the msync of a slot
+// run on a background thread. The file holds every market and symbol of the
+// config, the file of a smaller config is grown with its snapshots kept.
+class Checkpointer : private boost::noncopyable {
+ private:
+  int fd_ = -1;
+  Header* file_ = nullptr;  // the slots follow the header
+  size_t size_ = 0;         // of the mapping
+  uint32_t max_quotes_;     // capacities of the config
+  uint32_t max_coins_;
+  uint64_t generation_ = 0;  // written by the writer thread after load
+  models::Context& ctx_;
+
+  // save() fills staging_ and hands it over as pending_, the writer thread
+  // takes it as writing_, a newer pending snapshot replaces an unwritten one
+  std::unique_ptr<Snapshot> staging_;
+  std::unique_ptr<Snapshot> pending_;
+  std::unique_ptr<Snapshot> writing_;
+  bool has_pending_ = false;
+  bool stop_ = false;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
+
+ public:
+  explicit Checkpointer(models::Context& ctx);
+  ~Checkpointer();
+
+  // Restores quotes as stale and the scanner aggregates from the newest valid
+  // slot, `stats` is sized by the caller. Returns false if there is nothing
+  // to restore. Called before the first save.
+  bool load(Stats& stats);
+  // Copies the quotes and `stats` for the writer thread, does not wait for
+  // the disk.
+  void save(const Stats& stats);
+
+ private:
+  void reset();
+  void grow();
+  void run();
+  void write(const Snapshot& snapshot);
+};
+
+}  // namespace checkpoint
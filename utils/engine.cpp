@@ -0,0 +1,199 @@
+#include "engine.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+#include <thread>
+
+#include <quill/detail/LogMacros.h>
+
+#include "binance.hpp"
+#include "gateio.hpp"
+#include "mexc.hpp"
+
+namespace engine {
+
+namespace {
+
+void pin_thread(const models::CoinContext& coin_ctx,
+                quill::Logger* const& main_logger) {
+#ifdef __linux__
+  const auto cpu = coin_ctx.options.cpu;
+  const auto cpus = std::thread::hardware_concurrency();
+  if (cpu >= CPU_SETSIZE || (cpus && static_cast<unsigned>(cpu) >= cpus)) {
+    LOG_WARNING(main_logger, "Cpu {} is out of range [0, {}), not pinned! {}",
+                cpu, cpus ? cpus : CPU_SETSIZE, coin_ctx.to_str());
+    return;
+  }
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set)) {
+    LOG_WARNING(main_logger, "Failed to pin stream to cpu {}! {}",
+                cpu, coin_ctx.to_str());
+  }
+#else
+  LOG_WARNING(main_logger, "Thread pinning is not supported! {}",
+              coin_ctx.to_str());
+#endif
+}
+
+void run_stream(models::CoinContext& coin_ctx,
+                quill::Logger* const& main_logger, std::stop_token stop) {
+  if (coin_ctx.options.cpu >= 0) {
+    pin_thread(coin_ctx, main_logger);
+  }
+  perf::set_thread_name(coin_ctx.to_str());
+
+  try {
+    if (coin_ctx.exchange == Exchange::kBinance) {
+      stream::RunBinanceStream(coin_ctx, main_logger, stop);
+    } else if (coin_ctx.exchange == Exchange::kMexc) {
+      stream::RunMexcStream(coin_ctx, main_logger, stop);
+    } else if (coin_ctx.exchange == Exchange::kGate) {
+      stream::RunGateStream(coin_ctx, main_logger, stop);
+    }
+  } catch (const std::exception& e) {
+    // the read of a stopped stream fails on the shut down socket
+    if (!stop.stop_requested()) {
+      throw;
+    }
+  }
+  LOG_INFO(main_logger, "Stream stopped. {}", coin_ctx.to_str());
+}
+
+void run_subscriber(models::Context& ctx, std::stop_token stop) {
+  bus::QuoteSubscriber subscriber(ctx);
+  subscriber.run(stop);
+}
+
+}  // namespace
+
+Engine::Engine(const std::string& config_filename) : ctx_(config_filename) {
+  if (ctx_.perf.enabled) {
+    perf::enable(ctx_.main_logger);
+    perf_reporter_ = std::make_unique<perf::Reporter>(ctx_);
+  }
+  if (ctx_.feed.enabled) {
+    feed_writer_ = std::make_unique<feed::FeedWriter>(ctx_);
+    for (auto& ctx_by_coin : ctx_.coin_to_ctx) {
+      for (models::CoinContext& coin_ctx : ctx_by_coin) {
+        coin_ctx.feed_writer = feed_writer_.get();
+      }
+    }
+  }
+  if (ctx_.tick_store.enabled) {
+    tick_store_ = std::make_unique<ticks::TickStore>(ctx_);
+  }
+  if (ctx_.mode == models::Mode::kIngest) {
+    publisher_ = std::make_unique<bus::QuotePublisher>(ctx_);
+  } else {
+    scanner_ = std::make_unique<scanner::Scanner>(ctx_);
+    scanner_->set_feed_writer(feed_writer_.get());
+    if (ctx_.triangular.enabled) {
+      graph_ = std::make_unique<arbitrage::Graph>(ctx_);
+    }
+  }
+}
+
+Engine::~Engine() {
+  stop();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void Engine::on_quote(QuoteCallback callback) {
+  quote_callback_ = std::move(callback);
+}
+
+void Engine::on_opportunity(scanner::OpportunityCallback callback) {
+  if (scanner_) {
+    scanner_->set_callback(std::move(callback));
+  }
+}
+
+void Engine::on_cycle(arbitrage::CycleCallback callback) {
+  if (graph_) {
+    graph_->set_callback(std::move(callback));
+  }
+}
+
+scanner::OpportunityQueue& Engine::opportunity_queue(size_t capacity) {
+  if (!queue_) {
+    queue_ = std::make_unique<scanner::OpportunityQueue>(capacity);
+    if (scanner_) {
+      scanner_->set_queue(queue_.get());
+    }
+  }
+  return *queue_;
+}
+
+void Engine::set_log_spread(bool enabled) {
+  if (scanner_) {
+    scanner_->set_log_spread(enabled);
+  }
+}
+
+void Engine::start() {
+  LOG_INFO(ctx_.main_logger, "Start engine!");
+
+  if (publisher_ || graph_ || tick_store_ || quote_callback_) {
+    for (auto& ctx_by_coin : ctx_.coin_to_ctx) {
+      for (models::CoinContext& coin_ctx : ctx_by_coin) {
+        coin_ctx.on_update = [this](const models::CoinContext& c) {
+          if (publisher_) {
+            publisher_->publish(c);
+          }
+          if (graph_) {
+            graph_->update(c);
+          }
+          if (tick_store_) {
+            tick_store_->push(c);
+          }
+          if (quote_callback_) {
+            quote_callback_(c);
+          }
+        };
+      }
+    }
+  }
+
+  if (ctx_.mode == models::Mode::kScanner) {
+    threads_.emplace_back(run_subscriber, std::ref(ctx_),
+                          stop_source_.get_token());
+    return;
+  }
+
+  for (auto& ctx_by_coin : ctx_.coin_to_ctx) {
+    for (models::CoinContext& coin_ctx : ctx_by_coin) {
+      LOG_INFO(ctx_.main_logger, "Starting stream. {}!", coin_ctx.to_str());
+
+      threads_.emplace_back(run_stream, std::ref(coin_ctx), ctx_.main_logger,
+                            stop_source_.get_token());
+    }
+  }
+}
+
+void Engine::poll() {
+  if (scanner_) {
+    scanner_->run_once();
+  }
+}
+
+void Engine::run() {
+  if (publisher_) {
+    publisher_->run(stop_source_.get_token());
+  } else {
+    scanner_->run(stop_source_.get_token());
+  }
+}
+
+void Engine::stop() {
+  if (stop_source_.request_stop()) {
+    LOG_INFO(ctx_.main_logger, "Stop engine!");
+  }
+}
+
+}  // namespace engine
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "arbitrage.hpp"
+#include "context.hpp"
+#include "feed.hpp"
+#include "perf.hpp"
+#include "quote_bus.hpp"
+#include "scanner.hpp"
+#include "tick_store.hpp"
+
+namespace engine {
+
+using QuoteCallback = std::function<void(const models::CoinContext&)>;
+
+// Public entry point of the scanner library. Owns the context, the stream
+// threads and the scanner; the role of the process is taken from "mode".
+//
+//   engine::Engine engine("config.json");
+//   engine.on_opportunity([](const scanner::Opportunity& o) { ... });
+//   engine.start();
+//   while (...) { engine.poll(); ... }  // or engine.run();
+//   engine.stop();  // or just destroy it
+class Engine : private boost::noncopyable {
+ private:
+  models::Context ctx_;
+  std::unique_ptr<feed::FeedWriter> feed_writer_;
+  std::unique_ptr<scanner::Scanner> scanner_;
+  std::unique_ptr<bus::QuotePublisher> publisher_;
+  std::unique_ptr<arbitrage::Graph> graph_;
+  std::unique_ptr<ticks::TickStore> tick_store_;
+  std::unique_ptr<scanner::OpportunityQueue> queue_;
+  std::unique_ptr<perf::Reporter> perf_reporter_;
+  QuoteCallback quote_callback_;
+  std::stop_source stop_source_;
+  std::vector<std::thread> threads_;  // streams or the bus subscriber
+
+ public:
+  explicit Engine(const std::string& config_filename);
+  // Stops and joins the threads of `start`.
+  ~Engine();
+
+  models::Context& context() { return ctx_; }
+
+  // Called on the stream threads after every quote update. Must be set
+  // before `start`.
+  void on_quote(QuoteCallback callback);
+  // Called on the thread that drives the scanner (`poll` or `run`).
+  void on_opportunity(scanner::OpportunityCallback callback);
+  // Lock-free queue of opportunities for one consumer thread, an
+  // alternative to the callback. `capacity` must be a power of two.
+  scanner::OpportunityQueue& opportunity_queue(size_t capacity = 1024);
+  // Called on the stream threads for every profitable cycle of the rate
+  // graph, requires "triangular.enabled".
+  void on_cycle(arbitrage::CycleCallback callback);
+  // Formatted spread logs, enabled by default.
+  void set_log_spread(bool enabled);
+
+  // Starts stream threads, or the bus subscriber in scanner mode.
+  void start();
+  // One scanner pass on the calling thread.
+  void poll();
+  // Blocking scanner loop with "scan_frequency_ms", or the publisher loop in
+  // ingest mode, until `stop`.
+  void run();
+  // Thread safe. Ends `run` and the threads of `start`: their sockets are
+  // shut down, so blocked reads return. The threads are joined by the
+  // destructor, the engine can not be started again.
+  void stop();
+};
+
+}  // namespace engine
@@ -0,0 +1,526 @@
+#include "feed.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <system_error>
+
+#include <quill/detail/LogMacros.h>
+
+namespace feed {
+
+namespace {
+
+// records of the stream threads are dropped beyond this while the writer
+// is stalled, so a slow disk can not exhaust memory
+constexpr size_t kMaxPendingBytes = 64 << 20;
+constexpr size_t kCompressBufferSize = 1 << 16;
+
+#ifdef __linux__
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioIdle = 3 << 13;  // IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)
+#endif
+
+int64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// <first time ms> of a segment file, nullopt - not a segment of the feed
+std::optional<int64_t> first_ms(const std::filesystem::path& path) {
+  const auto name = path.filename().string();
+  int64_t ms = 0;
+  const auto [end, ec] =
+      std::from_chars(name.data(), name.data() + name.size(), ms);
+  if (ec != std::errc() || end == name.data() + name.size() || *end != '.') {
+    return std::nullopt;
+  }
+  return ms;
+}
+
+// segment files of the directory accepted by the filter, oldest first
+std::vector<std::filesystem::path> list_segments(
+    const std::filesystem::path& dir,
+    const std::function<bool(const std::filesystem::path&)>& filter) {
+  std::vector<std::pair<int64_t, std::filesystem::path>> files;
+  for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+    const auto ms = first_ms(entry.path());
+    if (ms && filter(entry.path())) {
+      files.emplace_back(*ms, entry.path());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  std::vector<std::filesystem::path> paths;
+  for (auto& [ms, path] : files) {
+    paths.push_back(std::move(path));
+  }
+  return paths;
+}
+
+[[noreturn]] void throw_errno(const std::string& what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+// <first time ms>.log or .log.gz of an index file
+std::filesystem::path data_path(const std::filesystem::path& index) {
+  auto path = index;
+  path.replace_extension(".log.gz");
+  if (std::filesystem::exists(path)) {
+    return path;
+  }
+  return path.replace_extension();
+}
+
+bool parse_block(const std::string& line, Block& block) {
+  std::istringstream stream(line);
+  std::string channel;
+  std::string number;
+  if (!std::getline(stream, block.symbol, ',') ||
+      !std::getline(stream, block.exchange, ',') ||
+      !std::getline(stream, channel, ',') ||
+      !parse_channel(channel, block.channel)) {
+    return false;
+  }
+  uint64_t* const fields[] = {&block.offset, &block.length};
+  for (auto* field : fields) {
+    if (!std::getline(stream, number, ',')) {
+      return false;
+    }
+    *field = std::stoull(number);
+  }
+  int64_t* const times[] = {&block.first_us, &block.last_us};
+  for (auto* time : times) {
+    if (!std::getline(stream, number, ',')) {
+      return false;
+    }
+    *time = std::stoll(number);
+  }
+  return true;
+}
+
+}  // namespace
+
+std::string_view channel_name(Channel channel) {
+  switch (channel) {
+    case Channel::kIn:
+      return "in";
+    case Channel::kOut:
+      return "out";
+    case Channel::kSpread:
+      return "spread";
+  }
+  return "unknown";
+}
+
+bool parse_channel(std::string_view name, Channel& channel) {
+  for (size_t i = 0; i < kChannels; ++i) {
+    if (channel_name(Channel(i)) == name) {
+      channel = Channel(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+FeedWriter::FeedWriter(models::Context& ctx) : ctx_(ctx) {
+  // markets without an exchange context stay empty and are never flushed
+  size_t streams = 0;
+  writing_.resize(ctx_.market_count() * kChannels);
+  for (const auto& ctx_by_coin : ctx_.coin_to_ctx) {
+    for (const auto& coin_ctx : ctx_by_coin) {
+      for (size_t channel = 0; channel < kChannels; ++channel) {
+        writing_[coin_ctx.market_id() * kChannels + channel] = {
+            .coin_ctx = &coin_ctx,
+            .channel = Channel(channel),
+            .data = {},
+            .first_us = 0,
+            .last_us = 0};
+        ++streams;
+      }
+    }
+  }
+  pending_ = std::vector<Pending>(writing_.size());
+
+  // segments of the previous run are compressed, unfinished archives of an
+  // interrupted compression are dropped
+  std::filesystem::create_directories(ctx_.feed.path);
+  // every segment of the directory is taken for our own, a second writer
+  // would compress and remove the open segment of the first one
+  const auto lock_path = std::filesystem::path(ctx_.feed.path) / ".lock";
+  lock_fd_ = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock_fd_ < 0) {
+    throw_errno("open " + lock_path.string());
+  }
+  if (::flock(lock_fd_, LOCK_EX | LOCK_NB) != 0) {
+    const auto error = errno;
+    ::close(lock_fd_);
+    throw std::system_error(
+        error, std::generic_category(),
+        "feed directory " + ctx_.feed.path + " is used by another process");
+  }
+  for (const auto& entry :
+       std::filesystem::directory_iterator(ctx_.feed.path)) {
+    const auto& path = entry.path();
+    if (!first_ms(path)) {
+      continue;
+    }
+    if (path.extension() == ".log") {
+      to_compress_.push_back(path);
+    } else if (path.extension() == ".tmp") {
+      std::filesystem::remove(path);
+    }
+  }
+
+  thread_ = std::thread(&FeedWriter::run, this);
+  compress_thread_ = std::thread(&FeedWriter::run_compressor, this);
+  LOG_INFO(ctx_.main_logger,
+           "Feed writer started. [path={}; streams={}; segment_mb={}; "
+           "segment_minutes={}; retention_segments={}; retention_hours={}]",
+           ctx_.feed.path, streams, ctx_.feed.segment_mb,
+           ctx_.feed.segment_minutes.count(), ctx_.feed.retention_segments,
+           ctx_.feed.retention_hours.count());
+}
+
+FeedWriter::~FeedWriter() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+  {
+    std::lock_guard lock(compress_mutex_);
+    to_compress_.clear();  // the next run compresses the rest
+    compress_stop_ = true;
+  }
+  compress_cv_.notify_one();
+  compress_thread_.join();
+  ::close(lock_fd_);
+}
+
+void FeedWriter::write(const models::CoinContext& coin_ctx, Channel channel,
+                       std::string_view payload) {
+  const auto time_us = now_us();
+  const auto id =
+      coin_ctx.market_id() * kChannels + static_cast<size_t>(channel);
+
+  if (pending_bytes_.load(std::memory_order_relaxed) > kMaxPendingBytes) {
+    const auto dropped = dropped_.fetch_add(1, std::memory_order_relaxed);
+    if (dropped % 10000 == 0) {
+      LOG_WARNING(ctx_.main_logger, "Feed writer is behind. [dropped={}]",
+                  dropped + 1);
+    }
+    return;
+  }
+  // only the writer thread competes for the lock, once per flush
+  auto& stream = pending_[id];
+  std::lock_guard lock(stream.mutex);
+  if (stream.data.empty()) {
+    stream.first_us = time_us;
+  }
+  stream.last_us = time_us;
+  const auto size = stream.data.size();
+  fmt::format_to(std::back_inserter(stream.data), "{} {} ", time_us,
+                 payload.size());
+  stream.data.append(payload);
+  stream.data.push_back('\n');
+  pending_bytes_.fetch_add(stream.data.size() - size,
+                           std::memory_order_relaxed);
+}
+
+void FeedWriter::run() {
+  while (true) {
+    bool stop = false;
+    {
+      std::unique_lock lock(mutex_);
+      cv_.wait_for(lock, ctx_.feed.flush_interval_ms,
+                   [this] { return stop_; });
+      stop = stop_;
+    }
+    collect();
+    flush();
+    if (stop) {
+      close_segment();
+      return;
+    }
+  }
+}
+
+// Takes the queued records of every stream, the buffers are swapped, so the
+// allocations are reused.
+void FeedWriter::collect() {
+  for (size_t id = 0; id < pending_.size(); ++id) {
+    auto& pending = pending_[id];
+    auto& stream = writing_[id];
+    std::lock_guard lock(pending.mutex);
+    if (pending.data.empty()) {
+      continue;
+    }
+    std::swap(pending.data, stream.data);
+    stream.first_us = pending.first_us;
+    stream.last_us = pending.last_us;
+    pending_bytes_.fetch_sub(stream.data.size(), std::memory_order_relaxed);
+  }
+}
+
+void FeedWriter::flush() {
+  const bool empty =
+      std::all_of(writing_.begin(), writing_.end(),
+                  [](const Stream& stream) { return stream.data.empty(); });
+  if (empty) {
+    return;
+  }
+  if (!data_) {
+    open_segment();
+    if (!data_) {
+      for (auto& stream : writing_) {
+        stream.data.clear();
+      }
+      return;
+    }
+  }
+
+  for (auto& stream : writing_) {
+    if (stream.data.empty()) {
+      continue;
+    }
+    std::fwrite(stream.data.data(), 1, stream.data.size(), data_);
+    fmt::print(index_, "{},{},{},{},{},{},{}\n", stream.coin_ctx->symbol,
+               exchange_dir(stream.coin_ctx->exchange),
+               channel_name(stream.channel), segment_bytes_,
+               stream.data.size(), stream.first_us, stream.last_us);
+    segment_bytes_ += stream.data.size();
+    stream.data.clear();
+  }
+  // an index line is visible to readers only after its data
+  std::fflush(data_);
+  std::fflush(index_);
+
+  if (segment_bytes_ >= ctx_.feed.segment_mb << 20 ||
+      std::chrono::steady_clock::now() - segment_opened_ >=
+          ctx_.feed.segment_minutes) {
+    close_segment();
+  }
+}
+
+void FeedWriter::open_segment() {
+  const auto segment_ms = now_us() / 1000;
+  const auto path =
+      std::filesystem::path(ctx_.feed.path) / std::to_string(segment_ms);
+  segment_path_ = std::filesystem::path(path).replace_extension(".log");
+  // before the file exists, so the retention never takes it for a closed one
+  open_first_ms_ = segment_ms;
+  data_ = std::fopen(segment_path_.c_str(), "wb");
+  index_ = std::fopen(
+      std::filesystem::path(path).replace_extension(".idx").c_str(), "w");
+  if (!data_ || !index_) {
+    LOG_ERROR(ctx_.main_logger, "Failed to open feed segment {}: {}",
+              segment_path_.string(), std::strerror(errno));
+    close_segment();
+    return;
+  }
+  segment_bytes_ = 0;
+  segment_opened_ = std::chrono::steady_clock::now();
+}
+
+void FeedWriter::close_segment() {
+  open_first_ms_ = -1;
+  if (index_) {
+    std::fclose(index_);
+    index_ = nullptr;
+  }
+  if (!data_) {
+    return;
+  }
+  std::fclose(data_);
+  data_ = nullptr;
+  {
+    std::lock_guard lock(compress_mutex_);
+    to_compress_.push_back(segment_path_);
+  }
+  compress_cv_.notify_one();
+}
+
+void FeedWriter::run_compressor() {
+#ifdef __linux__
+  // both cpu and disk are given to the streams first
+  const auto tid = static_cast<id_t>(::syscall(SYS_gettid));
+  if (::setpriority(PRIO_PROCESS, tid, 19) ||
+      ::syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, kIoprioIdle)) {
+    LOG_WARNING(ctx_.main_logger,
+                "Failed to lower priority of the feed compressor: {}",
+                std::strerror(errno));
+  }
+#endif
+
+  while (true) {
+    std::filesystem::path path;
+    {
+      std::unique_lock lock(compress_mutex_);
+      compress_cv_.wait(
+          lock, [this] { return compress_stop_ || !to_compress_.empty(); });
+      if (to_compress_.empty()) {
+        return;
+      }
+      path = std::move(to_compress_.front());
+      to_compress_.pop_front();
+    }
+    compress(path);
+    apply_retention();
+  }
+}
+
+void FeedWriter::compress(const std::filesystem::path& path) {
+  if (!std::filesystem::exists(path)) {
+    return;  // removed by the retention before its turn
+  }
+  const auto archive = std::filesystem::path(path).concat(".gz");
+  const auto tmp = std::filesystem::path(archive).concat(".tmp");
+
+  std::ifstream in(path, std::ios::binary);
+  const auto mode = fmt::format("wb{}", ctx_.feed.compression_level);
+  gzFile out = gzopen(tmp.c_str(), mode.c_str());
+  if (!in || !out) {
+    LOG_ERROR(ctx_.main_logger, "Failed to compress feed segment {}",
+              path.string());
+    if (out) {
+      gzclose(out);
+    }
+    std::filesystem::remove(tmp);
+    return;
+  }
+
+  std::vector<char> buffer(kCompressBufferSize);
+  bool ok = true;
+  while (ok && in) {
+    in.read(buffer.data(), buffer.size());
+    const auto size = static_cast<unsigned>(in.gcount());
+    ok = size == 0 || gzwrite(out, buffer.data(), size) == int(size);
+  }
+  ok = gzclose(out) == Z_OK && ok && in.eof();
+  if (!ok) {
+    LOG_ERROR(ctx_.main_logger, "Failed to compress feed segment {}",
+              path.string());
+    std::filesystem::remove(tmp);
+    return;
+  }
+  std::filesystem::rename(tmp, archive);
+  std::filesystem::remove(path);
+  LOG_DEBUG(ctx_.main_logger, "Feed segment compressed. [path={}]",
+            archive.string());
+}
+
+void FeedWriter::apply_retention() {
+  const auto& options = ctx_.feed;
+  if (!options.retention_segments && !options.retention_hours.count()) {
+    return;
+  }
+
+  // closed segments, compressed or left as .log by a failed compression
+  const auto open_first_ms = open_first_ms_.load();
+  const auto archives = list_segments(
+      options.path, [open_first_ms](const std::filesystem::path& path) {
+        return path.extension() == ".gz" ||
+               (path.extension() == ".log" && first_ms(path) != open_first_ms);
+      });
+
+  const auto now_ms = now_us() / 1000;
+  const auto max_age_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          options.retention_hours)
+          .count();
+  for (size_t i = 0; i < archives.size(); ++i) {
+    const bool too_many = options.retention_segments &&
+                          archives.size() - i > options.retention_segments;
+    const bool too_old =
+        max_age_ms && now_ms - *first_ms(archives[i]) > max_age_ms;
+    if (!too_many && !too_old) {
+      break;
+    }
+    auto index = archives[i];
+    if (index.extension() == ".gz") {
+      index.replace_extension();
+    }
+    index.replace_extension(".idx");
+    std::filesystem::remove(archives[i]);
+    std::filesystem::remove(index);
+    LOG_INFO(ctx_.main_logger, "Feed segment removed. [path={}]",
+             archives[i].string());
+  }
+}
+
+FeedReader::FeedReader(const std::filesystem::path& path)
+    : indexes_(list_segments(path, [](const std::filesystem::path& file) {
+        return file.extension() == ".idx";
+      })) {}
+
+void FeedReader::read(Channel channel, const std::string& symbol,
+                      const RecordCallback& callback) const {
+  for (size_t segment = 0; segment < indexes_.size(); ++segment) {
+    read_segment(segment, channel, symbol, callback);
+  }
+}
+
+void FeedReader::read_segment(size_t segment, Channel channel,
+                              const std::string& symbol,
+                              const RecordCallback& callback) const {
+  const auto& index = indexes_[segment];
+  std::vector<char> buffer;
+  std::vector<Block> blocks;
+  std::ifstream in(index);
+  std::string line;
+  Block block;
+  while (std::getline(in, line)) {
+    if (parse_block(line, block) && block.channel == channel &&
+        (symbol.empty() || block.symbol == symbol)) {
+      blocks.push_back(block);
+    }
+  }
+  if (blocks.empty()) {
+    return;
+  }
+
+  // gzread reads uncompressed files as is, seeks are forward only, so the
+  // segment is decompressed once however many blocks are read
+  gzFile data = gzopen(data_path(index).c_str(), "rb");
+  if (!data) {
+    return;
+  }
+  for (const auto& block : blocks) {
+    buffer.resize(block.length + 1);
+    if (gzseek(data, block.offset, SEEK_SET) < 0 ||
+        gzread(data, buffer.data(), block.length) != int(block.length)) {
+      break;
+    }
+    buffer.back() = '\0';  // stops strtoll on a truncated block
+    std::string_view rest(buffer.data(), block.length);
+    while (!rest.empty()) {
+      char* end = nullptr;
+      const auto time_us = std::strtoll(rest.data(), &end, 10);
+      const auto size = std::strtoull(end, &end, 10);
+      const auto begin = end + 1 - rest.data();
+      if (begin + size + 1 > rest.size()) {
+        break;
+      }
+      callback(block, time_us, rest.substr(begin, size));
+      rest.remove_prefix(begin + size + 1);
+    }
+  }
+  gzclose(data);
+}
+
+}  // namespace feed
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "context.hpp"
+
+namespace feed {
+
+enum class Channel : uint8_t {
+  kIn,      // frames received from the exchange
+  kOut,     // messages sent to the exchange
+  kSpread,  // formatted scanner spreads, filed under the maker
+};
+
+inline constexpr size_t kChannels = 3;
+
+std::string_view channel_name(Channel channel);
+bool parse_channel(std::string_view name, Channel& channel);
+
+// Contiguous run of records of one (symbol, exchange, channel) in a segment,
+// one line of the index file.
+struct Block {
+  std::string symbol;
+  std::string exchange;
+  Channel channel;
+  uint64_t offset;  // in the uncompressed data
+  uint64_t length;
+  int64_t first_us;
+  int64_t last_us;
+};
+
+// One writer of the raw feed and the spreads of all coins. Records are
+// buffered per (coin context, channel) and appended block by block to the
+// current segment, so the data of one coin is found through the index
+// without reading the others:
+//
+//   <path>/<first time ms>.log  - records "<time us> <size> <payload>\n"
+//   <path>/<first time ms>.idx  - blocks "symbol,exchange,channel,offset,
+//                                 length,first us,last us"
+//
+// Segments are rotated by size or age; closed ones are gzipped to .log.gz by
+// a low priority thread, which also applies the retention to closed segments,
+// compressed or not.
+class FeedWriter : private boost::noncopyable {
+ private:
+  struct Stream {
+    const models::CoinContext* coin_ctx = nullptr;
+    Channel channel = Channel::kIn;
+    std::string data;
+    int64_t first_us = 0;
+    int64_t last_us = 0;
+  };
+
+  // records of one stream queued by write(), each behind its own mutex, so
+  // the stream threads and the scanner do not wait for each other
+  struct Pending {
+    std::mutex mutex;
+    std::string data;
+    int64_t first_us = 0;
+    int64_t last_us = 0;
+  };
+
+  std::vector<Pending> pending_;  // by market id and channel
+  std::vector<Stream> writing_;   // owned by the writer thread
+  std::atomic<size_t> pending_bytes_ = 0;
+  std::atomic<uint64_t> dropped_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+
+  // current segment, owned by the writer thread
+  std::atomic<int64_t> open_first_ms_ = -1;  // -1 - no open segment
+  std::FILE* data_ = nullptr;
+  std::FILE* index_ = nullptr;
+  std::filesystem::path segment_path_;
+  uint64_t segment_bytes_ = 0;
+  std::chrono::steady_clock::time_point segment_opened_;
+
+  std::mutex compress_mutex_;
+  std::condition_variable compress_cv_;
+  std::deque<std::filesystem::path> to_compress_;
+  bool compress_stop_ = false;
+
+  std::thread thread_;
+  std::thread compress_thread_;
+  int lock_fd_ = -1;  // flock of the directory, one writer per directory
+
+  models::Context& ctx_;
+
+ public:
+  explicit FeedWriter(models::Context& ctx);
+  ~FeedWriter();
+
+  // Thread safe, called on the stream and scanner threads.
+  void write(const models::CoinContext& coin_ctx, Channel channel,
+             std::string_view payload);
+
+ private:
+  void run();
+  void collect();
+  void flush();
+  void open_segment();
+  void close_segment();
+  void run_compressor();
+  void compress(const std::filesystem::path& path);
+  void apply_retention();
+};
+
+using RecordCallback =
+    std::function<void(const Block& block, int64_t time_us,
+                       std::string_view payload)>;
+
+// Read side of the feed, compressed and open segments alike.
+class FeedReader : private boost::noncopyable {
+ private:
+  std::vector<std::filesystem::path> indexes_;  // ordered by first time
+
+ public:
+  explicit FeedReader(const std::filesystem::path& path);
+
+  // Records of `channel` in write order, of every symbol if `symbol` is
+  // empty. Records of one (symbol, exchange) are ordered by time.
+  void read(Channel channel, const std::string& symbol,
+            const RecordCallback& callback) const;
+
+  // Segments in time order, read() is read_segment() of each of them.
+  size_t segments() const { return indexes_.size(); }
+  void read_segment(size_t segment, Channel channel, const std::string& symbol,
+                    const RecordCallback& callback) const;
+};
+
+}  // namespace feed
@@ -15,9 +15,9 @@ const quill::Timezone kLoggerTimezone = quill::Timezone::GmtTime;
 
 }  // namespace
 
-quill::Logger* init_root_logger() {
+quill::Logger* init_root_logger(const std::string& filename) {
   std::shared_ptr<quill::Handler> file_handler =
-      quill::file_handler("logs/main.log", "w");
+      quill::file_handler(filename, "w");
   file_handler->set_pattern(kLoggerFormatPattern, kLoggerTimestampFormat,
                             kLoggerTimezone);
 
@@ -14,7 +14,8 @@ inline const std::string kLoggerFormatPattern =
 
 }  // namespace impl
 
-quill::Logger* init_root_logger();
+quill::Logger* init_root_logger(
+    const std::string& filename = "logs/main.log");
 
 quill::Logger* make_logger(
     const std::string& filename,
@@ -0,0 +1,271 @@
+#include "perf.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <quill/detail/LogMacros.h>
+
+namespace perf {
+
+namespace {
+
+struct Totals {
+  std::atomic<uint64_t> calls = 0;
+  std::array<std::atomic<uint64_t>, kEvents> values{};
+};
+
+// Counter group of one thread. Totals are written by the owner thread only
+// and read by the reporter.
+struct ThreadCounters {
+  std::string name;  // guarded by registry_mutex
+  int group = -1;    // leader fd, -1 - counters are not available
+  std::array<int, kEvents> fds;
+  std::array<int, kEvents> slots;  // position in a group read, -1 - not open
+  std::array<Totals, kSections> totals;
+
+  ThreadCounters() {
+    fds.fill(-1);
+    slots.fill(-1);
+  }
+
+  ~ThreadCounters() {
+#ifdef __linux__
+    for (const auto fd : fds) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+#endif
+  }
+};
+
+quill::Logger* logger = nullptr;
+std::mutex registry_mutex;
+std::vector<std::shared_ptr<ThreadCounters>> registry;
+thread_local std::shared_ptr<ThreadCounters> current;
+thread_local std::string current_name;
+
+#ifdef __linux__
+struct EventConfig {
+  uint32_t type;
+  uint64_t config;
+};
+
+constexpr EventConfig kEventConfigs[kEvents] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+int open_event(const EventConfig& event, int group, bool user_only) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.exclude_kernel = user_only;
+  attr.exclude_hv = 1;
+  return static_cast<int>(
+      ::syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+}
+#endif
+
+// One group per thread, so a section costs two read() syscalls. Events
+// missing on this machine (e.g. no PMU in a VM) are reported as 0.
+void open_counters(ThreadCounters& counters) {
+#ifdef __linux__
+  int slot = 0;
+  for (size_t i = 0; i < kEvents; ++i) {
+    // context switches happen in the kernel, hardware events are counted in
+    // user space only to work with perf_event_paranoid=2
+    const bool software = kEventConfigs[i].type == PERF_TYPE_SOFTWARE;
+    int fd = open_event(kEventConfigs[i], counters.group, !software);
+    if (fd < 0 && software) {
+      fd = open_event(kEventConfigs[i], counters.group, true);
+    }
+    if (fd < 0) {
+      continue;
+    }
+    if (counters.group < 0) {
+      counters.group = fd;
+    }
+    counters.fds[i] = fd;
+    counters.slots[i] = slot++;
+  }
+#endif
+  if (counters.group < 0) {
+    LOG_WARNING(logger, "Perf counters are not available! [thread={}; {}]",
+                counters.name, std::strerror(errno));
+  }
+}
+
+ThreadCounters& thread_counters() {
+  if (!current) {
+    current = std::make_shared<ThreadCounters>();
+    {
+      std::lock_guard lock(registry_mutex);
+      current->name = current_name.empty()
+                          ? fmt::format("thread-{}", registry.size())
+                          : current_name;
+      registry.push_back(current);
+    }
+    open_counters(*current);
+  }
+  return *current;
+}
+
+}  // namespace
+
+std::string_view section_name(Section section) {
+  switch (section) {
+    case Section::kDecode:
+      return "decode";
+    case Section::kBinance:
+      return "binance";
+    case Section::kMexc:
+      return "mexc";
+    case Section::kGate:
+      return "gate";
+    case Section::kScan:
+      return "scan";
+    case Section::kLogSpread:
+      return "log_spread";
+  }
+  return "unknown";
+}
+
+namespace detail {
+
+bool read(Values& values) {
+  const auto& counters = thread_counters();
+  if (counters.group < 0) {
+    return false;
+  }
+#ifdef __linux__
+  uint64_t buffer[1 + kEvents];  // nr, then the values in open order
+  if (::read(counters.group, buffer, sizeof(buffer)) < 0) {
+    return false;
+  }
+  for (size_t i = 0; i < kEvents; ++i) {
+    values[i] = counters.slots[i] < 0 ? 0 : buffer[1 + counters.slots[i]];
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void add(Section section, const Values& begin) {
+  Values end;
+  if (!read(end)) {
+    return;
+  }
+  auto& totals = current->totals[static_cast<size_t>(section)];
+  totals.calls.store(totals.calls.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+  for (size_t i = 0; i < kEvents; ++i) {
+    auto& value = totals.values[i];
+    value.store(value.load(std::memory_order_relaxed) + end[i] - begin[i],
+                std::memory_order_relaxed);
+  }
+}
+
+}  // namespace detail
+
+void enable(quill::Logger* main_logger) {
+  logger = main_logger;
+  detail::enabled = true;
+}
+
+void set_thread_name(std::string name) {
+  current_name = std::move(name);
+  if (current) {
+    std::lock_guard lock(registry_mutex);
+    current->name = current_name;
+  }
+}
+
+Reporter::Reporter(models::Context& ctx) : ctx_(ctx) {
+  thread_ = std::thread(&Reporter::run, this);
+}
+
+Reporter::~Reporter() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void Reporter::run() {
+  // totals of the previous report: calls, then the events
+  using Snapshot = std::array<std::array<uint64_t, 1 + kEvents>, kSections>;
+  std::unordered_map<const ThreadCounters*, Snapshot> previous;
+
+  while (true) {
+    {
+      std::unique_lock lock(mutex_);
+      if (cv_.wait_for(lock, ctx_.perf.report_interval_ms,
+                       [this] { return stop_; })) {
+        return;
+      }
+    }
+
+    std::vector<std::pair<std::string, std::shared_ptr<ThreadCounters>>>
+        threads;
+    {
+      std::lock_guard lock(registry_mutex);
+      for (const auto& counters : registry) {
+        threads.emplace_back(counters->name, counters);
+      }
+    }
+
+    for (const auto& [name, counters] : threads) {
+      auto& last = previous[counters.get()];
+      for (size_t s = 0; s < kSections; ++s) {
+        const auto& totals = counters->totals[s];
+        std::array<uint64_t, 1 + kEvents> now;
+        now[0] = totals.calls.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < kEvents; ++i) {
+          now[1 + i] = totals.values[i].load(std::memory_order_relaxed);
+        }
+        const auto calls = now[0] - last[s][0];
+        if (!calls) {
+          continue;
+        }
+        Values delta;
+        for (size_t i = 0; i < kEvents; ++i) {
+          delta[i] = now[1 + i] - last[s][1 + i];
+        }
+        last[s] = now;
+
+        LOG_INFO(ctx_.main_logger,
+                 "Perf counters. [thread={}; section={}; calls={}; "
+                 "cycles/call={:.0f}; ipc={:.2f}; cache_misses/call={:.2f}; "
+                 "branch_misses/call={:.2f}; context_switches={}]",
+                 name, section_name(Section(s)), calls,
+                 double(delta[kCycles]) / calls,
+                 delta[kCycles] ? double(delta[kInstructions]) / delta[kCycles]
+                                : 0.,
+                 double(delta[kCacheMisses]) / calls,
+                 double(delta[kBranchMisses]) / calls,
+                 delta[kContextSwitches]);
+      }
+    }
+  }
+}
+
+}  // namespace perf
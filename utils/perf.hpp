@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <quill/Logger.h>
+#include <boost/noncopyable.hpp>
+
+#include "context.hpp"
+
+namespace perf {
+
+// Instrumented hot sections.
+enum class Section : uint8_t {
+  kDecode,     // json parse of a frame, WebsocketBaseStream::read
+  kBinance,    // frame to top of book, per exchange
+  kMexc,
+  kGate,
+  kScan,       // Scanner::run_once
+  kLogSpread,  // Scanner::log_spread
+};
+
+inline constexpr size_t kSections = 6;
+
+enum Event : uint8_t {
+  kCycles,
+  kInstructions,
+  kCacheMisses,
+  kBranchMisses,
+  kContextSwitches,
+};
+
+inline constexpr size_t kEvents = 5;
+
+using Values = std::array<uint64_t, kEvents>;
+
+std::string_view section_name(Section section);
+
+namespace detail {
+
+// Set once by `enable` before the threads start, so a disabled scope is a
+// single predictable branch.
+inline bool enabled = false;
+
+// Counters of the calling thread, false if they can not be opened.
+bool read(Values& values);
+void add(Section section, const Values& begin);
+
+}  // namespace detail
+
+// Turns the counters on for the whole process, see "perf" in config.json.
+void enable(quill::Logger* main_logger);
+// Label of the calling thread in the reports.
+void set_thread_name(std::string name);
+
+// Adds the counters spent between construction and destruction to the
+// totals of `section` of the calling thread. Nested scopes are inclusive.
+class Scope : private boost::noncopyable {
+ private:
+  Section section_;
+  bool active_ = false;
+  Values begin_;
+
+ public:
+  explicit Scope(Section section) : section_(section) {
+    if (detail::enabled) [[unlikely]] {
+      active_ = detail::read(begin_);
+    }
+  }
+
+  ~Scope() {
+    if (active_) [[unlikely]] {
+      detail::add(section_, begin_);
+    }
+  }
+};
+
+// Logs the per thread and section counters of every interval to the main
+// log.
+class Reporter : private boost::noncopyable {
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;
+  std::thread thread_;
+  models::Context& ctx_;
+
+ public:
+  explicit Reporter(models::Context& ctx);
+  ~Reporter();
+
+ private:
+  void run();
+};
+
+}  // namespace perf
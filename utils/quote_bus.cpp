@@ -0,0 +1,415 @@
+#include "quote_bus.hpp"
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include <quill/detail/LogMacros.h>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/multicast.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+namespace bus {
+
+namespace {
+
+const auto kStatsPeriod = std::chrono::seconds(10);
+const auto kMinReconnectBackoff = std::chrono::milliseconds(100);
+const auto kMaxReconnectBackoff = std::chrono::milliseconds(10000);
+// ~4.5MB of quotes behind the writer, newer ones are dropped
+constexpr size_t kMaxQueued = 65536;
+
+// Safe beside a read or accept blocked on the socket in another thread, unlike
+// the calls of the asio socket. The blocked call returns at once.
+void shutdown_socket(int fd) { ::shutdown(fd, SHUT_RDWR); }
+
+int64_t to_ms(const TimePoint& time_point) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             time_point.time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+QuotePublisher::QuotePublisher(models::Context& ctx)
+    : epoch_(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::system_clock::now().time_since_epoch())
+                 .count()),
+      ctx_(ctx) {
+  const auto& options = ctx_.bus;
+  if (options.tcp) {
+    connect_thread_ = std::thread(&QuotePublisher::run_connector, this);
+    writer_thread_ = std::thread(&QuotePublisher::run_writer, this);
+  } else {
+    udp_endpoint_ = asio::ip::udp::endpoint(
+        asio::ip::make_address_v4(options.address), options.port);
+    udp_socket_.open(asio::ip::udp::v4());
+    udp_socket_.set_option(asio::ip::multicast::outbound_interface(
+        asio::ip::make_address_v4(options.interface)));
+    udp_socket_.set_option(asio::ip::multicast::enable_loopback(true));
+    udp_socket_.set_option(asio::ip::multicast::hops(1));
+  }
+  LOG_INFO(ctx_.main_logger,
+           "Quote publisher started. [node={}; epoch={}; transport={}; "
+           "address={}; port={}]",
+           options.node_id, epoch_, options.tcp ? "tcp" : "multicast",
+           options.address, options.port);
+}
+
+QuotePublisher::~QuotePublisher() {
+  if (!connect_thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+    // a write blocked on a stalled scanner returns
+    if (connected_) {
+      shutdown_socket(tcp_socket_.native_handle());
+    }
+  }
+  cv_.notify_one();
+  writer_cv_.notify_one();
+  connect_thread_.join();
+  writer_thread_.join();
+}
+
+void QuotePublisher::run_connector() {
+  const auto& options = ctx_.bus;
+  auto backoff = kMinReconnectBackoff;
+  while (true) {
+    {
+      std::unique_lock lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || !connected_; });
+      if (stop_) {
+        return;
+      }
+    }
+
+    // connecting may take long, publishers are not blocked meanwhile
+    asio::ip::tcp::socket socket(io_ctx_);
+    boost::system::error_code ec;
+    asio::ip::tcp::resolver resolver(io_ctx_);
+    const auto endpoints =
+        resolver.resolve(options.address, std::to_string(options.port), ec);
+    if (!ec) {
+      asio::connect(socket, endpoints, ec);
+    }
+    if (!ec) {
+      socket.set_option(asio::ip::tcp::no_delay(true), ec);
+    }
+
+    std::unique_lock lock(mutex_);
+    if (!ec) {
+      tcp_socket_ = std::move(socket);
+      connected_ = true;
+      backoff = kMinReconnectBackoff;
+      LOG_INFO(ctx_.main_logger, "Quote publisher connected to {}:{}",
+               options.address, options.port);
+      continue;
+    }
+    LOG_WARNING(ctx_.main_logger,
+                "Quote publisher failed to connect to {}:{}: {}, retry in "
+                "{}ms",
+                options.address, options.port, ec.message(), backoff.count());
+    if (cv_.wait_for(lock, backoff, [this] { return stop_; })) {
+      return;
+    }
+    backoff = std::min(backoff * 2, kMaxReconnectBackoff);
+  }
+}
+
+void QuotePublisher::publish(const models::CoinContext& coin_ctx) {
+  QuoteMsg msg{};
+  msg.magic = kMagic;
+  msg.node_id = ctx_.bus.node_id;
+  msg.epoch = epoch_;
+  msg.exchange = static_cast<uint8_t>(coin_ctx.exchange);
+  msg.symbol_size = std::min(coin_ctx.symbol.size(), kMaxSymbolSize);
+  std::memcpy(msg.symbol, coin_ctx.symbol.data(), msg.symbol_size);
+  msg.bid_pure = static_cast<double>(coin_ctx.bid_pure);
+  msg.ask_pure = static_cast<double>(coin_ctx.ask_pure);
+  msg.bid_time_ms = to_ms(coin_ctx.bid_time);
+  msg.ask_time_ms = to_ms(coin_ctx.ask_time);
+
+  std::lock_guard lock(mutex_);
+  msg.sequence = sequence_++;
+  if (!ctx_.bus.tcp) {
+    send(msg);
+    return;
+  }
+  if (queue_.size() == kMaxQueued) {
+    ++dropped_;
+    return;
+  }
+  queue_.push_back(msg);
+  if (queue_.size() == 1) {
+    writer_cv_.notify_one();
+  }
+}
+
+void QuotePublisher::run_writer() {
+  std::vector<QuoteMsg> messages;
+  while (true) {
+    {
+      std::unique_lock lock(mutex_);
+      writer_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (stop_) {
+        return;  // quotes at exit are of no use to the scanner
+      }
+      std::swap(queue_, messages);
+    }
+    write(messages);
+    messages.clear();
+  }
+}
+
+// A datagram does not wait for the receiver.
+void QuotePublisher::send(const QuoteMsg& msg) {
+  boost::system::error_code ec;
+  udp_socket_.send_to(asio::buffer(&msg, sizeof(msg)), udp_endpoint_, 0, ec);
+  if (ec) {
+    ++errors_;
+  } else {
+    ++sent_;
+  }
+}
+
+void QuotePublisher::write(const std::vector<QuoteMsg>& messages) {
+  {
+    std::lock_guard lock(mutex_);
+    if (!connected_) {
+      dropped_ += messages.size();
+      return;
+    }
+  }
+  // the connector replaces the socket only while disconnected
+  boost::system::error_code ec;
+  asio::write(tcp_socket_, asio::buffer(messages), ec);
+  if (!ec) {
+    sent_ += messages.size();
+    return;
+  }
+  ++errors_;
+  LOG_WARNING(ctx_.main_logger, "Quote publisher disconnected: {}",
+              ec.message());
+  std::lock_guard lock(mutex_);
+  tcp_socket_.close(ec);
+  connected_ = false;
+  cv_.notify_one();
+}
+
+void QuotePublisher::run(std::stop_token stop) {
+  // the wait ends early on a stop request
+  std::mutex sleep_mutex;
+  std::condition_variable_any sleep_cv;
+  std::unique_lock sleep_lock(sleep_mutex);
+  while (true) {
+    sleep_cv.wait_for(sleep_lock, stop, kStatsPeriod, [] { return false; });
+    if (stop.stop_requested()) {
+      return;
+    }
+    uint64_t published = 0;
+    {
+      std::lock_guard lock(mutex_);
+      published = sequence_;
+    }
+    LOG_INFO(ctx_.main_logger,
+             "Quote publisher. [published={}; sent={}; errors={}; "
+             "dropped={}]",
+             published, sent_.load(), errors_.load(), dropped_.load());
+  }
+}
+
+QuoteSubscriber::QuoteSubscriber(models::Context& ctx) : ctx_(ctx) {
+  coin_ctxs_.resize(ctx_.market_count());
+  for (auto& ctx_by_coin : ctx_.coin_to_ctx) {
+    for (auto& coin_ctx : ctx_by_coin) {
+      coin_ctxs_[coin_ctx.market_id()] = &coin_ctx;
+    }
+  }
+}
+
+void QuoteSubscriber::run(std::stop_token stop) {
+  LOG_INFO(ctx_.main_logger,
+           "Quote subscriber started. [transport={}; address={}; port={}]",
+           ctx_.bus.tcp ? "tcp" : "multicast", ctx_.bus.address,
+           ctx_.bus.port);
+  if (ctx_.bus.tcp) {
+    run_tcp(stop);
+  } else {
+    run_multicast(stop);
+  }
+}
+
+void QuoteSubscriber::run_multicast(std::stop_token stop) {
+  const auto group = asio::ip::make_address_v4(ctx_.bus.address);
+  asio::ip::udp::socket socket(io_ctx_);
+  socket.open(asio::ip::udp::v4());
+  socket.set_option(asio::ip::udp::socket::reuse_address(true));
+  socket.bind({asio::ip::address_v4::any(), ctx_.bus.port});
+  socket.set_option(asio::ip::multicast::join_group(
+      group, asio::ip::make_address_v4(ctx_.bus.interface)));
+
+  // a shut down udp socket reads empty datagrams
+  std::stop_callback on_stop(
+      stop, [fd = socket.native_handle()] { shutdown_socket(fd); });
+  QuoteMsg msg;
+  asio::ip::udp::endpoint sender;
+  while (true) {
+    const auto size =
+        socket.receive_from(asio::buffer(&msg, sizeof(msg)), sender);
+    if (stop.stop_requested()) {
+      return;
+    }
+    if (size != sizeof(msg) || msg.magic != kMagic) {
+      LOG_WARNING(ctx_.main_logger, "Bad quote datagram from {}:{}",
+                  sender.address().to_string(), sender.port());
+      continue;
+    }
+    apply(msg);
+  }
+}
+
+void QuoteSubscriber::run_tcp(std::stop_token stop) {
+  asio::ip::tcp::acceptor acceptor(
+      io_ctx_, {asio::ip::tcp::v4(), ctx_.bus.port});
+  std::stop_callback on_stop(
+      stop, [fd = acceptor.native_handle()] { shutdown_socket(fd); });
+  // owned by this thread, a publisher reconnects with a new one
+  std::list<Connection> connections;
+  while (true) {
+    boost::system::error_code ec;
+    auto socket = acceptor.accept(ec);
+    if (stop.stop_requested()) {
+      break;
+    }
+    if (ec) {
+      throw boost::system::system_error(ec);
+    }
+    LOG_INFO(ctx_.main_logger, "Quote publisher connected from {}",
+             socket.remote_endpoint().address().to_string());
+    connections.remove_if([](Connection& connection) {
+      if (!connection.done) {
+        return false;
+      }
+      connection.thread.join();
+      return true;
+    });
+    auto& connection = connections.emplace_back(std::move(socket));
+    connection.thread =
+        std::thread(&QuoteSubscriber::receive_tcp, this, std::ref(connection));
+  }
+  for (auto& connection : connections) {
+    shutdown_socket(connection.socket.native_handle());
+    connection.thread.join();
+  }
+}
+
+void QuoteSubscriber::receive_tcp(Connection& connection) {
+  auto& socket = connection.socket;
+  boost::system::error_code ec;
+  socket.set_option(asio::ip::tcp::no_delay(true), ec);
+  QuoteMsg msg;
+  while (asio::read(socket, asio::buffer(&msg, sizeof(msg)), ec) ==
+         sizeof(msg)) {
+    if (msg.magic != kMagic) {
+      LOG_ERROR(ctx_.main_logger, "Bad quote stream, closing connection");
+      break;
+    }
+    apply(msg);
+  }
+  if (ec) {
+    LOG_WARNING(ctx_.main_logger, "Quote publisher disconnected: {}",
+                ec.message());
+  }
+  // closed when run_tcp reaps the connection, the publisher reconnects
+  shutdown_socket(socket.native_handle());
+  connection.done = true;
+}
+
+bool QuoteSubscriber::check_sequence(const QuoteMsg& msg) {
+  auto& node = nodes_[msg.node_id];
+  // A restarted publisher has a new epoch and counts from 0 again, this does
+  // not rely on its first message arriving.
+  if (msg.epoch < node.epoch) {
+    // a restart may leave a few late ones, a steady flow means that two
+    // publishers have the same node id and one of them is dropped
+    ++node.old_epoch;
+    const auto now = std::chrono::steady_clock::now();
+    if (now - node.old_epoch_logged >= kStatsPeriod) {
+      node.old_epoch_logged = now;
+      LOG_ERROR(ctx_.main_logger,
+                "Quotes of an old epoch dropped, is node id {} used by two "
+                "ingest nodes? [epoch={}; old_epoch={}; dropped={}]",
+                msg.node_id, node.epoch, msg.epoch, node.old_epoch);
+    }
+    return false;
+  }
+  if (msg.epoch > node.epoch) {
+    // the head of a new epoch counts as lost, a node seen for the first time
+    // starts where it is
+    const bool restarted = node.received;
+    if (restarted) {
+      LOG_WARNING(ctx_.main_logger,
+                  "Quote node {} restarted. [epoch={}; received={}]",
+                  msg.node_id, msg.epoch, node.received);
+    }
+    node = {.epoch = msg.epoch,
+            .next_sequence = restarted ? 0 : msg.sequence};
+  }
+  if (msg.sequence < node.next_sequence) {
+    LOG_DEBUG(ctx_.main_logger, "Late quote dropped. [node={}; seq={}]",
+              msg.node_id, msg.sequence);
+    return false;
+  }
+  if (msg.sequence > node.next_sequence) {
+    // Every message carries the full top of book, so a gap only means that
+    // intermediate quotes are lost. The next message is still authoritative.
+    const auto lost = msg.sequence - node.next_sequence;
+    node.lost += lost;
+    LOG_WARNING(ctx_.main_logger,
+                "Quote gap. [node={}; expected={}; received={}; lost={}; "
+                "lost_total={}]",
+                msg.node_id, node.next_sequence, msg.sequence, lost,
+                node.lost);
+  }
+  node.next_sequence = msg.sequence + 1;
+  ++node.received;
+  return true;
+}
+
+void QuoteSubscriber::apply(const QuoteMsg& msg) {
+  std::lock_guard lock(mutex_);
+  if (!check_sequence(msg)) {
+    return;
+  }
+  if (msg.exchange > static_cast<uint8_t>(Exchange::kGate) ||
+      msg.symbol_size > kMaxSymbolSize) {
+    LOG_WARNING(ctx_.main_logger, "Bad quote. [node={}; seq={}]", msg.node_id,
+                msg.sequence);
+    return;
+  }
+
+  // ids are local to the node, the wire carries the name
+  const auto symbol_id =
+      ctx_.symbols.find(std::string_view(msg.symbol, msg.symbol_size));
+  if (!symbol_id) {
+    return;
+  }
+  auto* const target = coin_ctxs_[*symbol_id * kExchanges + msg.exchange];
+  if (!target) {
+    return;
+  }
+  auto& coin_ctx = *target;
+  coin_ctx.set_top(msg.bid_pure, msg.ask_pure);
+  coin_ctx.bid_time = TimePoint(std::chrono::milliseconds(msg.bid_time_ms));
+  coin_ctx.ask_time = TimePoint(std::chrono::milliseconds(msg.ask_time_ms));
+  coin_ctx.notify();
+}
+
+}  // namespace bus
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <quill/Logger.h>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+
+#include "context.hpp"
+
+namespace bus {
+
+namespace asio = boost::asio;
+
+inline constexpr uint32_t kMagic = 0x32425143;  // "CQB2"
+
+// Normalized top of book as it goes over the wire. Fixed size, host byte
+// order (all nodes are expected to be little-endian x86/arm).
+#pragma pack(push, 1)
+struct QuoteMsg {
+  uint32_t magic;
+  uint16_t node_id;
+  uint8_t exchange;
+  uint8_t symbol_size;
+  uint64_t epoch;     // start time of the publisher process, ns
+  uint64_t sequence;  // per node and epoch, starts from 0
+  char symbol[kMaxSymbolSize];
+  double bid_pure;
+  double ask_pure;
+  int64_t bid_time_ms;
+  int64_t ask_time_ms;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(QuoteMsg) == 72);
+
+// Publishes quote updates of an ingest node. `publish` is called from the
+// stream threads, so numbering is serialized to keep sequence numbers in
+// order. A datagram is sent at once, in tcp mode the message is queued and a
+// writer thread sends the queue, so a stalled scanner never blocks the
+// streams. The scanner may start later or restart: a connector thread
+// (re)connects with backoff, quotes published meanwhile are dropped.
+class QuotePublisher : private boost::noncopyable {
+ private:
+  asio::io_context io_ctx_{};
+  asio::ip::udp::socket udp_socket_{io_ctx_};
+  asio::ip::udp::endpoint udp_endpoint_;
+  asio::ip::tcp::socket tcp_socket_{io_ctx_};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;         // connector
+  std::condition_variable writer_cv_;  // writer
+  std::vector<QuoteMsg> queue_;        // tcp, published and not sent yet
+  bool connected_ = false;
+  bool stop_ = false;
+  uint64_t epoch_;
+  uint64_t sequence_ = 0;
+  std::atomic<uint64_t> sent_ = 0;
+  std::atomic<uint64_t> errors_ = 0;
+  // published while disconnected or with a full queue, the scanner sees them
+  // as sequence gaps
+  std::atomic<uint64_t> dropped_ = 0;
+  std::thread connect_thread_;
+  std::thread writer_thread_;
+
+  models::Context& ctx_;
+
+ public:
+  explicit QuotePublisher(models::Context& ctx);
+  ~QuotePublisher();
+
+  void publish(const models::CoinContext& coin_ctx);
+  // Periodically logs publisher counters until `stop` is requested.
+  void run(std::stop_token stop = {});
+
+ private:
+  void send(const QuoteMsg& msg);
+  void write(const std::vector<QuoteMsg>& messages);
+  void run_connector();
+  void run_writer();
+};
+
+// Receives quote updates from ingest nodes and applies them to the local
+// context of a scanner node.
+class QuoteSubscriber : private boost::noncopyable {
+ private:
+  struct NodeState {
+    uint64_t epoch = 0;
+    uint64_t next_sequence = 0;
+    uint64_t received = 0;
+    uint64_t lost = 0;
+    uint64_t old_epoch = 0;  // quotes of an older epoch than the current one
+    std::chrono::steady_clock::time_point old_epoch_logged{};
+  };
+
+  // tcp connection of a publisher, served by its own thread
+  struct Connection {
+    asio::ip::tcp::socket socket;
+    std::thread thread;
+    std::atomic<bool> done = false;
+  };
+
+  asio::io_context io_ctx_{};
+
+  std::vector<models::CoinContext*> coin_ctxs_;  // by market id
+  std::mutex mutex_;
+  std::unordered_map<uint16_t, NodeState> nodes_;
+
+  models::Context& ctx_;
+
+ public:
+  explicit QuoteSubscriber(models::Context& ctx);
+
+  // Blocking receive loop until `stop` is requested, which shuts the sockets
+  // down from the requesting thread.
+  void run(std::stop_token stop = {});
+
+ private:
+  void run_multicast(std::stop_token stop);
+  void run_tcp(std::stop_token stop);
+  void receive_tcp(Connection& connection);
+  void apply(const QuoteMsg& msg);
+  bool check_sequence(const QuoteMsg& msg);
+};
+
+}  // namespace bus
@@ -1,15 +1,33 @@
 #include "scanner.hpp"
 
 #include <quill/detail/LogMacros.h>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 
 #include "logger.hpp"
+#include "perf.hpp"
 
 namespace scanner {
 
+Maker find_maker(const Quote& first, const Quote& second, Percent min_profit) {
+  if (first.ask == -1 || first.bid == -1 || second.ask == -1 ||
+      second.bid == -1) {
+    return Maker::kNone;
+  }
+  if (first.ask - second.bid > second.ask - first.bid &&
+      first.ask - second.bid >= first.ask * min_profit * 0.01) {
+    return Maker::kFirst;
+  } else if (second.ask - first.bid >= first.ask - second.bid &&
+             second.ask - first.bid >= second.ask * min_profit * 0.01) {
+    return Maker::kSecond;
+  }
+  return Maker::kNone;
+}
+
+Percent calc_spread(Money ask, Money bid) { return 100 * (ask - bid) / ask; }
+
 Scanner::Scanner(models::Context& ctx) : ctx_(ctx) {
-  static const fmt::format_string<std::string> kProfitFileTemplate =
-      "spread/{}.csv";
   static const std::string kFormatPatternLog = "%(ascii_time),%(message)";
 
   LOG_INFO(ctx.main_logger, "Start constructor scanner!");
@@ -17,65 +35,157 @@ Scanner::Scanner(models::Context& ctx) : ctx_(ctx) {
   common_logger_ = logger::make_logger("spread/all.csv", kFormatPatternLog);
   common_logger_->set_log_level(ctx.main_logger->log_level());
 
-  for (const auto& [coin, _] : ctx_.coin_to_ctx) {
-    auto filename = fmt::format(fmt::runtime(kProfitFileTemplate), coin);
-    loggers_[coin] =
-        logger::make_logger(std::move(filename), kFormatPatternLog);
-    loggers_[coin]->set_log_level(ctx.main_logger->log_level());
+  stats_.resize(ctx_.coin_to_ctx.size());
+  if (!ctx_.checkpoint_path.empty()) {
+    checkpointer_ = std::make_unique<checkpoint::Checkpointer>(ctx_);
+    checkpointer_->load(stats_);
+    last_checkpoint_ = std::chrono::steady_clock::now();
   }
 }
 
-void Scanner::run() {
+void Scanner::run(std::stop_token stop) {
   LOG_DEBUG(ctx_.main_logger, "Start run scanner.");
+  perf::set_thread_name("scanner");
+
+  // the wait ends early on a stop request
+  std::mutex mutex;
+  std::condition_variable_any cv;
+  std::unique_lock lock(mutex);
+  while (!stop.stop_requested()) {
+    run_once();
+    cv.wait_for(lock, stop, ctx_.scan_frequency_ms, [] { return false; });
+  }
+}
 
-  while (true) {
-    LOG_DEBUG(common_logger_, "Start iteration.");
-    for (const auto& [_, ctx_by_coin] : ctx_.coin_to_ctx) {
-      for (int i = 0; i < ctx_by_coin.size(); ++i) {
-        if (ctx_by_coin[i].ask != -1 && ctx_by_coin[i].bid != -1) {
-          for (int j = i + 1; j < ctx_by_coin.size(); ++j) {
-            check_profit(ctx_by_coin[i], ctx_by_coin[j]);
-          }
+void Scanner::run_once() {
+  perf::Scope scope(perf::Section::kScan);
+  LOG_DEBUG(common_logger_, "Start iteration.");
+  current_time_ = std::chrono::system_clock::now();
+  for (SymbolId symbol_id = 0; symbol_id < ctx_.coin_to_ctx.size();
+       ++symbol_id) {
+    const auto& ctx_by_coin = ctx_.coin_to_ctx[symbol_id];
+    current_stats_ = &stats_[symbol_id];
+    current_found_ = false;
+    for (int i = 0; i < ctx_by_coin.size(); ++i) {
+      if (is_usable(ctx_by_coin[i])) {
+        for (int j = i + 1; j < ctx_by_coin.size(); ++j) {
+          check_profit(ctx_by_coin[i], ctx_by_coin[j]);
         }
       }
     }
-    LOG_DEBUG(common_logger_, "Finish iteration.");
-    std::this_thread::sleep_for(ctx_.scan_frequency_ms);
+    update_stats();
+  }
+  LOG_DEBUG(common_logger_, "Finish iteration.");
+
+  if (checkpointer_) {
+    const auto now = std::chrono::steady_clock::now();
+    if (now - last_checkpoint_ >= ctx_.checkpoint_interval_ms) {
+      checkpointer_->save(stats_);
+      last_checkpoint_ = now;
+    }
+  }
+}
+
+void Scanner::update_stats() {
+  auto& stats = *current_stats_;
+  if (!current_found_) {
+    stats.in_episode = false;
+    return;
+  }
+  ++stats.opportunities;
+  if (!stats.in_episode) {
+    ++stats.episodes;
+    stats.in_episode = true;
+  }
+}
+
+void Scanner::set_callback(OpportunityCallback callback) {
+  callback_ = std::move(callback);
+}
+
+void Scanner::set_queue(OpportunityQueue* queue) { queue_ = queue; }
+
+void Scanner::set_log_spread(bool enabled) { log_spread_ = enabled; }
+
+void Scanner::set_feed_writer(feed::FeedWriter* feed_writer) {
+  feed_writer_ = feed_writer;
+}
+
+bool Scanner::is_usable(const models::CoinContext& coin_ctx) const {
+  if (coin_ctx.ask == -1 || coin_ctx.bid == -1 || coin_ctx.stale) {
+    return false;
   }
+  return !ctx_.max_quote_age_ms.count() ||
+         current_time_ - std::min(coin_ctx.bid_time, coin_ctx.ask_time) <=
+             ctx_.max_quote_age_ms;
 }
 
 void Scanner::check_profit(const models::CoinContext& f,
                            const models::CoinContext& s) {
-  if (s.ask == -1 || s.bid == -1) {
+  if (!is_usable(s)) {
     return;
   }
-  LOG_DEBUG(loggers_.at(s.coin), "Start check profit! [{:^5}: {} and {}]",
-            s.coin, f.exchange, s.exchange);
-  if (f.ask - s.bid > s.ask - f.bid &&
-      f.ask - s.bid >= f.ask * ctx_.min_profit * 0.01) {
-    log_spread(f, s);
-  } else if (s.ask - f.bid >= f.ask - s.bid &&
-             s.ask - f.bid >= s.ask * ctx_.min_profit * 0.01) {
-    log_spread(s, f);
+  LOG_DEBUG(common_logger_, "Start check profit! [{:^5}: {} and {}]",
+            s.symbol, f.exchange, s.exchange);
+  switch (find_maker({f.bid, f.ask}, {s.bid, s.ask}, ctx_.min_profit)) {
+    case Maker::kFirst:
+      report(f, s);
+      break;
+    case Maker::kSecond:
+      report(s, f);
+      break;
+    case Maker::kNone:
+      break;
   }
 }
 
-void Scanner::log_spread(const models::CoinContext& maker,
-                         const models::CoinContext& taker) {
-  using namespace fmt::literals;
-
-  if (maker.coin != taker.coin) {
-    throw std::logic_error("maker.coin != taker.coin");
+void Scanner::report(const models::CoinContext& maker,
+                     const models::CoinContext& taker) {
+  if (maker.symbol_id != taker.symbol_id) {
+    throw std::logic_error("maker.symbol_id != taker.symbol_id");
   }
 
-  const auto& calc_stread = [](const Money& ask, const Money& bid) {
-    return 100 * (ask - bid) / ask;
+  const Opportunity opportunity{
+      .maker = &maker,
+      .taker = &taker,
+      .symbol_id = maker.symbol_id,
+      .spread = calc_spread(maker.ask, taker.bid),
+      .ask_pure = maker.ask_pure,
+      .ask = maker.ask,
+      .bid_pure = taker.bid_pure,
+      .bid = taker.bid,
+      .ask_time = maker.ask_time,
+      .bid_time = taker.bid_time,
   };
 
-  const auto spread = calc_stread(maker.ask, taker.bid);
+  current_found_ = true;
+  current_stats_->max_spread =
+      std::max(current_stats_->max_spread, opportunity.spread);
+  current_stats_->last_opportunity = std::chrono::system_clock::now();
+
+  if (callback_) {
+    callback_(opportunity);
+  }
+  if (queue_ && !queue_->try_push(opportunity)) {
+    if (queue_overflows_++ % 1000 == 0) {
+      LOG_WARNING(ctx_.main_logger, "Opportunity queue is full. [dropped={}]",
+                  queue_overflows_);
+    }
+  }
+  if (log_spread_) {
+    log_spread(opportunity);
+  }
+}
+
+void Scanner::log_spread(const Opportunity& opportunity) {
+  using namespace fmt::literals;
+  perf::Scope scope(perf::Section::kLogSpread);
+
+  const auto& maker = *opportunity.maker;
+  const auto& taker = *opportunity.taker;
   const auto diff_time =
       std::abs(std::chrono::duration_cast<std::chrono::milliseconds>(
-                   maker.ask_time - taker.bid_time)
+                   opportunity.ask_time - opportunity.bid_time)
                    .count());
 
   const auto log = fmt::format(
@@ -87,23 +197,25 @@ void Scanner::log_spread(const models::CoinContext& maker,
        "{exchange_taker:^10}, {bid_pure:^12.6f}, {bid_after_comm:^12.6f}, "
        "+{comm_taker:^6.4f}%, {bid_time:%Y-%m-%d %H:%M:%S}, "
        "{diff_time}ms"),
-      "exchange"_a = maker.exchange,        //
-      "coin"_a = maker.coin,                //
-      "spread"_a = spread,                  //
-      "exchange_maker"_a = maker.exchange,  //
-      "ask_pure"_a = maker.ask_pure,        //
-      "ask_after_comm"_a = maker.ask,       //
-      "comm_maker"_a = maker.comm_maker,    //
-      "ask_time"_a = maker.ask_time,        //
-      "exchange_taker"_a = taker.exchange,  //
-      "bid_pure"_a = taker.bid_pure,        //
-      "bid_after_comm"_a = taker.bid,       //
-      "comm_taker"_a = taker.comm_taker,    //
-      "bid_time"_a = taker.bid_time,        //
-      "diff_time"_a = diff_time,            //
+      "exchange"_a = maker.exchange,         //
+      "coin"_a = maker.symbol,               //
+      "spread"_a = opportunity.spread,       //
+      "exchange_maker"_a = maker.exchange,   //
+      "ask_pure"_a = opportunity.ask_pure,   //
+      "ask_after_comm"_a = opportunity.ask,  //
+      "comm_maker"_a = maker.comm_maker,     //
+      "ask_time"_a = opportunity.ask_time,   //
+      "exchange_taker"_a = taker.exchange,   //
+      "bid_pure"_a = opportunity.bid_pure,   //
+      "bid_after_comm"_a = opportunity.bid,  //
+      "comm_taker"_a = taker.comm_taker,     //
+      "bid_time"_a = opportunity.bid_time,   //
+      "diff_time"_a = diff_time,             //
       "space"_a = "");
-  LOG_INFO(loggers_.at(maker.coin), "{}", log);
   LOG_INFO(common_logger_, "{}", log);
+  if (feed_writer_) {
+    feed_writer_->write(maker, feed::Channel::kSpread, log);
+  }
 }
 
 }  // namespace scanner
\ No newline at end of file
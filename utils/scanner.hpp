@@ -1,27 +1,97 @@
 #pragma once
 
-#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <stop_token>
 
 #include <quill/Logger.h>
 
+#include "checkpoint.hpp"
 #include "context.hpp"
+#include "feed.hpp"
+#include "spsc_queue.hpp"
 
 namespace scanner {
 
+// Profitable combination of one coin found by the scanner. Prices and times
+// are copied at the moment of the scan, the contexts keep changing.
+struct Opportunity {
+  const models::CoinContext* maker;
+  const models::CoinContext* taker;
+  SymbolId symbol_id;  // index of Context::coin_to_ctx and Context::symbols
+  Percent spread;
+  Money ask_pure;
+  Money ask;  // after commission
+  Money bid_pure;
+  Money bid;  // after commission
+  TimePoint ask_time;
+  TimePoint bid_time;
+};
+
+// Top of book after commissions of one exchange, -1 - no price.
+struct Quote {
+  Money bid;
+  Money ask;
+};
+
+enum class Maker {
+  kNone,  // no profitable combination
+  kFirst,
+  kSecond,
+};
+
+// The decision of the scanner for two quotes of one coin, shared with the
+// backtest.
+Maker find_maker(const Quote& first, const Quote& second, Percent min_profit);
+Percent calc_spread(Money ask, Money bid);
+
+using OpportunityCallback = std::function<void(const Opportunity&)>;
+using OpportunityQueue = utils::SpscQueue<Opportunity>;
+
 class Scanner : private boost::noncopyable {
  private:
-  std::unordered_map<std::string, quill::Logger*> loggers_;
   quill::Logger* common_logger_;
+  feed::FeedWriter* feed_writer_ = nullptr;
   models::Context& ctx_;
 
+  OpportunityCallback callback_;
+  OpportunityQueue* queue_ = nullptr;
+  uint64_t queue_overflows_ = 0;
+  bool log_spread_ = true;
+
+  checkpoint::Stats stats_;
+  models::ScanStats* current_stats_ = nullptr;
+  TimePoint current_time_;
+  bool current_found_ = false;
+  std::unique_ptr<checkpoint::Checkpointer> checkpointer_;
+  std::chrono::steady_clock::time_point last_checkpoint_;
+
  public:
   Scanner(models::Context& ctx);
-  void run();
+  // Passes every "scan_frequency_ms" until `stop` is requested.
+  void run(std::stop_token stop = {});
+  // One pass over all coins, for callers with their own event loop.
+  void run_once();
+
+  // Called on the scanner thread for every opportunity.
+  void set_callback(OpportunityCallback callback);
+  // The scanner thread is the single producer of the queue.
+  void set_queue(OpportunityQueue* queue);
+  // Formatted spread logs, enabled by default.
+  void set_log_spread(bool enabled);
+  // Spreads of every coin are also written to the feed, filed under the
+  // maker.
+  void set_feed_writer(feed::FeedWriter* feed_writer);
+
+  const checkpoint::Stats& stats() const { return stats_; }
 
  private:
+  bool is_usable(const models::CoinContext& coin_ctx) const;
   void check_profit(const models::CoinContext& f, const models::CoinContext& s);
-  void log_spread(const models::CoinContext& maker,
-                  const models::CoinContext& taker);
+  void report(const models::CoinContext& maker,
+              const models::CoinContext& taker);
+  void log_spread(const Opportunity& opportunity);
+  void update_stats();
 };
 
-}  // namespace scanner
\ No newline at end of file
+}  // namespace scanner
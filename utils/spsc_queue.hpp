@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+namespace utils {
+
+// Bounded lock-free queue for exactly one producer and one consumer thread.
+template <typename T>
+class SpscQueue : private boost::noncopyable {
+ private:
+  static constexpr size_t kCacheLine = 64;
+
+  std::vector<T> items_;
+  const size_t mask_;
+  alignas(kCacheLine) std::atomic<size_t> head_ = 0;  // next to pop
+  alignas(kCacheLine) std::atomic<size_t> tail_ = 0;  // next to push
+
+ public:
+  // `capacity` must be a power of two.
+  explicit SpscQueue(size_t capacity) : items_(capacity), mask_(capacity - 1) {
+    if (capacity == 0 || (capacity & mask_) != 0) {
+      throw std::invalid_argument("SpscQueue capacity must be a power of two");
+    }
+  }
+
+  // Returns false if the queue is full.
+  bool try_push(const T& item) {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) == items_.size()) {
+      return false;
+    }
+    items_[tail & mask_] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> try_pop() {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return std::nullopt;
+    }
+    std::optional<T> item = std::move(items_[head & mask_]);
+    head_.store(head + 1, std::memory_order_release);
+    return item;
+  }
+
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+};
+
+}  // namespace utils
@@ -0,0 +1,334 @@
+#include "tick_store.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <system_error>
+
+#include <quill/detail/LogMacros.h>
+
+namespace ticks {
+
+namespace {
+
+constexpr uint32_t kMagic = 0x314b4954;  // "TIK1"
+constexpr uint32_t kVersion = 1;
+constexpr size_t kColumnsOffset = (sizeof(SegmentHeader) + 4095) / 4096 * 4096;
+constexpr size_t kRowSize = sizeof(int64_t) + 2 * sizeof(double);
+
+int64_t to_ms(const TimePoint& time_point) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             time_point.time_since_epoch())
+      .count();
+}
+
+void throw_errno(const std::string& what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Segments of a series by first time, the file names, other files are
+// skipped.
+std::vector<std::filesystem::path> list_segments(
+    const std::filesystem::path& dir) {
+  std::vector<std::pair<int64_t, std::filesystem::path>> files;
+  for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+    if (entry.path().extension() != ".seg") {
+      continue;
+    }
+    const auto stem = entry.path().stem().string();
+    int64_t first_ms = 0;
+    const auto [end, ec] =
+        std::from_chars(stem.data(), stem.data() + stem.size(), first_ms);
+    if (ec == std::errc() && end == stem.data() + stem.size()) {
+      files.emplace_back(first_ms, entry.path());
+    }
+  }
+  std::sort(files.begin(), files.end());
+  std::vector<std::filesystem::path> paths;
+  for (auto& [first_ms, path] : files) {
+    paths.push_back(std::move(path));
+  }
+  return paths;
+}
+
+}  // namespace
+
+Segment::Segment(const std::filesystem::path& path, bool create) {
+  fd_ = create ? ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644)
+               : ::open(path.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    throw_errno("open " + path.string());
+  }
+
+  if (create) {
+    size_ = kColumnsOffset + kSegmentCapacity * kRowSize;
+    if (::ftruncate(fd_, size_) < 0) {
+      throw_errno("ftruncate " + path.string());
+    }
+  } else {
+    struct stat st;
+    if (::fstat(fd_, &st) < 0) {
+      throw_errno("fstat " + path.string());
+    }
+    size_ = st.st_size;
+  }
+
+  const int prot = create ? PROT_READ | PROT_WRITE : PROT_READ;
+  void* addr = ::mmap(nullptr, size_, prot, MAP_SHARED, fd_, 0);
+  if (addr == MAP_FAILED) {
+    throw_errno("mmap " + path.string());
+  }
+  header_ = static_cast<SegmentHeader*>(addr);
+
+  if (create) {
+    header_->version = kVersion;
+    header_->capacity = kSegmentCapacity;
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = kMagic;
+  } else if (header_->magic != kMagic || header_->version != kVersion ||
+             size_ < kColumnsOffset + header_->capacity * kRowSize) {
+    ::munmap(addr, size_);
+    ::close(fd_);
+    throw std::runtime_error("bad tick segment " + path.string());
+  }
+
+  auto* columns = static_cast<char*>(addr) + kColumnsOffset;
+  const auto capacity = header_->capacity;
+  time_ = reinterpret_cast<int64_t*>(columns);
+  bid_ = reinterpret_cast<double*>(columns + capacity * sizeof(int64_t));
+  ask_ = reinterpret_cast<double*>(columns + capacity * (sizeof(int64_t) +
+                                                         sizeof(double)));
+}
+
+std::unique_ptr<Segment> Segment::open(const std::filesystem::path& path) {
+  // the file is sized and its header written after it is created
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw_errno("open " + path.string());
+  }
+  uint32_t magic = 0;
+  const auto size = ::pread(fd, &magic, sizeof(magic), 0);
+  ::close(fd);
+  if (size < 0) {
+    throw_errno("read " + path.string());
+  }
+  if (static_cast<size_t>(size) < sizeof(magic) || magic == 0) {
+    return nullptr;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return std::make_unique<Segment>(path, false);
+}
+
+Segment::~Segment() {
+  if (header_) {
+    ::munmap(header_, size_);
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void Segment::append(int64_t time_ms, double bid, double ask) {
+  const auto row = header_->count.load(std::memory_order_relaxed);
+  time_[row] = time_ms;
+  bid_[row] = bid;
+  ask_[row] = ask;
+  if (row == 0) {
+    header_->first_ms = time_ms;
+  }
+  if (row % kIndexStride == 0) {
+    const auto index = header_->index_count.load(std::memory_order_relaxed);
+    header_->index[index] = {.time_ms = time_ms, .row = row};
+    header_->index_count.store(index + 1, std::memory_order_release);
+  }
+  header_->last_ms.store(time_ms, std::memory_order_relaxed);
+  header_->count.store(row + 1, std::memory_order_release);
+}
+
+uint64_t Segment::lower_bound(int64_t time_ms) const {
+  const auto count = size();
+  const auto index_count =
+      std::min(header_->index_count.load(std::memory_order_acquire),
+               (count + kIndexStride - 1) / kIndexStride);
+  const IndexEntry* index_begin = header_->index;
+  const IndexEntry* index_end = index_begin + index_count;
+
+  // the block of the first index entry >= time_ms may start with a row
+  // >= time_ms, so the answer is in the previous block
+  const auto it = std::lower_bound(
+      index_begin, index_end, time_ms,
+      [](const IndexEntry& entry, int64_t t) { return entry.time_ms < t; });
+  const uint64_t begin = it == index_begin ? 0 : (it - 1)->row;
+  const uint64_t end = it == index_end ? count : std::min(it->row + 1, count);
+  return std::lower_bound(time_ + begin, time_ + end, time_ms) - time_;
+}
+
+TickStore::TickStore(models::Context& ctx) : ctx_(ctx) {
+  size_t count = 0;
+  series_.resize(ctx_.market_count());
+  for (const auto& ctx_by_coin : ctx_.coin_to_ctx) {
+    for (const auto& coin_ctx : ctx_by_coin) {
+      auto& series = series_[coin_ctx.market_id()];
+      series.dir = std::filesystem::path(ctx_.tick_store.path) /
+                   coin_ctx.symbol / exchange_dir(coin_ctx.exchange);
+      std::filesystem::create_directories(series.dir);
+      // a restart continues after the newest tick on disk
+      const auto paths = list_segments(series.dir);
+      for (auto it = paths.rbegin(); it != paths.rend(); ++it) {
+        try {
+          const auto segment = Segment::open(*it);
+          if (segment && segment->size()) {
+            series.last_ms = segment->header().last_ms;
+            break;
+          }
+        } catch (const std::exception& e) {
+          LOG_WARNING(ctx_.main_logger, "Tick segment skipped: {}", e.what());
+        }
+      }
+      ++count;
+    }
+  }
+  thread_ = std::thread(&TickStore::run, this);
+  LOG_INFO(ctx_.main_logger, "Tick store started. [path={}; series={}]",
+           ctx_.tick_store.path, count);
+}
+
+TickStore::~TickStore() {
+  {
+    std::lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void TickStore::push(const models::CoinContext& coin_ctx) {
+  const Tick tick{
+      .coin_ctx = &coin_ctx,
+      .time_ms = to_ms(std::max(coin_ctx.bid_time, coin_ctx.ask_time)),
+      .bid = static_cast<double>(coin_ctx.bid_pure),
+      .ask = static_cast<double>(coin_ctx.ask_pure),
+  };
+  std::lock_guard lock(mutex_);
+  pending_.push_back(tick);
+}
+
+void TickStore::run() {
+  while (true) {
+    {
+      std::unique_lock lock(mutex_);
+      cv_.wait_for(lock, ctx_.tick_store.flush_interval_ms,
+                   [this] { return stop_; });
+      std::swap(pending_, writing_);
+    }
+    for (const auto& tick : writing_) {
+      write(tick);
+    }
+    writing_.clear();
+
+    std::lock_guard lock(mutex_);
+    if (stop_ && pending_.empty()) {
+      return;
+    }
+  }
+}
+
+void TickStore::write(const Tick& tick) {
+  auto& series = series_[tick.coin_ctx->market_id()];
+  if (tick.time_ms < series.last_ms) {
+    if (series.dropped++ % 1000 == 0) {
+      LOG_WARNING(ctx_.main_logger,
+                  "Out of order tick dropped. [dropped={}] {}", series.dropped,
+                  tick.coin_ctx->to_str());
+    }
+    return;
+  }
+  if (!series.segment || series.segment->full()) {
+    const auto path = series.dir / (std::to_string(tick.time_ms) + ".seg");
+    try {
+      series.segment = std::make_unique<Segment>(path, true);
+    } catch (const std::exception& e) {
+      LOG_ERROR(ctx_.main_logger, "Failed to create tick segment: {}",
+                e.what());
+      series.segment.reset();
+      return;
+    }
+  }
+  series.segment->append(tick.time_ms, tick.bid, tick.ask);
+  series.last_ms = tick.time_ms;
+}
+
+TickReader::TickReader(const std::filesystem::path& path,
+                       const std::string& symbol, const std::string& exchange) {
+  for (const auto& file : list_segments(path / symbol / exchange)) {
+    if (auto segment = Segment::open(file)) {
+      segments_.push_back(std::move(segment));
+    }
+  }
+}
+
+std::vector<Slice> TickReader::range(int64_t from_ms, int64_t to_ms) const {
+  std::vector<Slice> result;
+  for (const auto& segment : segments_) {
+    const auto& header = segment->header();
+    if (!segment->size() || header.first_ms >= to_ms ||
+        header.last_ms.load(std::memory_order_relaxed) < from_ms) {
+      continue;
+    }
+    const auto begin = segment->lower_bound(from_ms);
+    const auto end = segment->lower_bound(to_ms);
+    if (begin < end) {
+      result.push_back({
+          .time = segment->time().subspan(begin, end - begin),
+          .bid = segment->bid().subspan(begin, end - begin),
+          .ask = segment->ask().subspan(begin, end - begin),
+      });
+    }
+  }
+  return result;
+}
+
+std::vector<Bar> TickReader::resample(int64_t from_ms, int64_t to_ms,
+                                      int64_t resolution_ms) const {
+  if (resolution_ms <= 0) {
+    throw std::invalid_argument("resolution_ms must be positive");
+  }
+  std::vector<Bar> bars;
+  for (const auto& slice : range(from_ms, to_ms)) {
+    for (size_t i = 0; i < slice.time.size(); ++i) {
+      const auto bid = slice.bid[i];
+      const auto ask = slice.ask[i];
+      if (bid <= 0 || ask <= 0) {
+        continue;
+      }
+      const auto mid = (bid + ask) / 2;
+      const auto start =
+          from_ms + (slice.time[i] - from_ms) / resolution_ms * resolution_ms;
+      if (bars.empty() || bars.back().time_ms != start) {
+        bars.push_back({.time_ms = start,
+                        .open = mid,
+                        .high = mid,
+                        .low = mid,
+                        .close = mid,
+                        .bid = bid,
+                        .ask = ask,
+                        .count = 0});
+      }
+      auto& bar = bars.back();
+      bar.high = std::max(bar.high, mid);
+      bar.low = std::min(bar.low, mid);
+      bar.close = mid;
+      bar.bid = bid;
+      bar.ask = ask;
+      ++bar.count;
+    }
+  }
+  return bars;
+}
+
+}  // namespace ticks
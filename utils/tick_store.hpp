@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "context.hpp"
+
+namespace ticks {
+
+inline constexpr uint64_t kSegmentCapacity = 1 << 18;  // rows per segment
+inline constexpr uint64_t kIndexStride = 1024;  // rows per sparse index entry
+inline constexpr uint64_t kIndexSize = kSegmentCapacity / kIndexStride;
+
+struct IndexEntry {
+  int64_t time_ms;
+  uint64_t row;
+};
+
+// Header of a segment file, followed by the time, bid and ask columns of
+// `capacity` rows each. `count` is published after the row is written, so a
+// reader never sees a half written row. `magic` is written last, zero - the
+// segment is being created.
+struct SegmentHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> index_count;
+  int64_t first_ms;
+  std::atomic<int64_t> last_ms;
+  IndexEntry index[kIndexSize];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+// Memory-mapped segment file of one (symbol, exchange).
+class Segment : private boost::noncopyable {
+ private:
+  int fd_ = -1;
+  size_t size_ = 0;
+  SegmentHeader* header_ = nullptr;
+  int64_t* time_ = nullptr;
+  double* bid_ = nullptr;
+  double* ask_ = nullptr;
+
+ public:
+  // Creates a new segment if `create`, opens an existing one otherwise.
+  Segment(const std::filesystem::path& path, bool create);
+  ~Segment();
+
+  // Opens an existing segment, nullptr if the writer is still creating it.
+  static std::unique_ptr<Segment> open(const std::filesystem::path& path);
+
+  const SegmentHeader& header() const { return *header_; }
+  uint64_t size() const {
+    return header_->count.load(std::memory_order_acquire);
+  }
+  bool full() const { return size() == header_->capacity; }
+
+  void append(int64_t time_ms, double bid, double ask);
+
+  // First row with time >= time_ms, uses the sparse index.
+  uint64_t lower_bound(int64_t time_ms) const;
+
+  std::span<const int64_t> time() const { return {time_, size()}; }
+  std::span<const double> bid() const { return {bid_, size()}; }
+  std::span<const double> ask() const { return {ask_, size()}; }
+};
+
+// Background writer of normalized quotes, one directory per (symbol,
+// exchange): <path>/<SYMBOL>/<exchange>/<first time ms>.seg
+class TickStore : private boost::noncopyable {
+ private:
+  struct Tick {
+    const models::CoinContext* coin_ctx;
+    int64_t time_ms;
+    double bid;
+    double ask;
+  };
+
+  struct Series {
+    std::filesystem::path dir;
+    std::unique_ptr<Segment> segment;
+    // of the last tick, also of the segments of a previous run
+    int64_t last_ms = std::numeric_limits<int64_t>::min();
+    uint64_t dropped = 0;  // out of order ticks
+  };
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Tick> pending_;
+  std::vector<Tick> writing_;
+  std::vector<Series> series_;  // by market id
+  std::thread thread_;
+  bool stop_ = false;
+
+  models::Context& ctx_;
+
+ public:
+  explicit TickStore(models::Context& ctx);
+  ~TickStore();
+
+  // Called on the stream threads after every quote update.
+  void push(const models::CoinContext& coin_ctx);
+
+ private:
+  void run();
+  void write(const Tick& tick);
+};
+
+struct Slice {
+  std::span<const int64_t> time;
+  std::span<const double> bid;
+  std::span<const double> ask;
+};
+
+// Top of book and OHLC of the mid price for one interval.
+struct Bar {
+  int64_t time_ms;  // start of the interval
+  double open;
+  double high;
+  double low;
+  double close;
+  double bid;  // last in the interval
+  double ask;  // last in the interval
+  uint64_t count;
+};
+
+// Read side of the store, segments are mapped read-only and can be queried
+// while the writer appends to them.
+class TickReader : private boost::noncopyable {
+ private:
+  std::vector<std::unique_ptr<Segment>> segments_;
+
+ public:
+  TickReader(const std::filesystem::path& path, const std::string& symbol,
+             const std::string& exchange);
+
+  // Zero-copy slices of rows with from_ms <= time < to_ms.
+  std::vector<Slice> range(int64_t from_ms, int64_t to_ms) const;
+  // Rows of [from_ms, to_ms) grouped by `resolution_ms`, empty intervals are
+  // skipped. Throws std::invalid_argument if `resolution_ms` is not positive.
+  std::vector<Bar> resample(int64_t from_ms, int64_t to_ms,
+                            int64_t resolution_ms) const;
+};
+
+}  // namespace ticks